@@ -0,0 +1,100 @@
+#include "ActuatorOutput.h"
+
+#include <cmath>
+
+static bool isControlChannel(ActuatorChannel channel)
+{
+    return channel >= ActuatorChannel::TARGET_PRESSURE;
+}
+
+static LogEvent logEventOf(ActuatorChannel channel)
+{
+    switch (channel)
+    {
+    case ActuatorChannel::TARGET_TEMPERATURE:
+        return LogEvent::SET_TARGET_TEMPERATURE;
+    case ActuatorChannel::TARGET_WEIGHT:
+        return LogEvent::SET_TARGET_WEIGHT;
+    case ActuatorChannel::PRESSURE_LIMIT:
+        return LogEvent::SET_LIMITED_PRESSURE;
+    case ActuatorChannel::FLOW_LIMIT:
+        return LogEvent::SET_LIMITED_FLOW;
+    case ActuatorChannel::TARGET_PRESSURE:
+        return LogEvent::SET_TARGET_PRESSURE;
+    case ActuatorChannel::TARGET_FLOW:
+        return LogEvent::SET_TARGET_FLOW;
+    case ActuatorChannel::TARGET_POWER:
+        return LogEvent::SET_TARGET_POWER;
+    default:
+        return LogEvent::SET_TARGET_PISTON_POSITION;
+    }
+}
+
+ActuatorOutput::ActuatorOutput()
+{
+    this->set_deadband(ActuatorChannel::TARGET_TEMPERATURE, ACTUATOR_DEADBAND_TEMPERATURE);
+    this->set_deadband(ActuatorChannel::TARGET_WEIGHT, ACTUATOR_DEADBAND_WEIGHT);
+    this->set_deadband(ActuatorChannel::PRESSURE_LIMIT, ACTUATOR_DEADBAND_PRESSURE);
+    this->set_deadband(ActuatorChannel::FLOW_LIMIT, ACTUATOR_DEADBAND_FLOW);
+    this->set_deadband(ActuatorChannel::TARGET_PRESSURE, ACTUATOR_DEADBAND_PRESSURE);
+    this->set_deadband(ActuatorChannel::TARGET_FLOW, ACTUATOR_DEADBAND_FLOW);
+    this->set_deadband(ActuatorChannel::TARGET_POWER, ACTUATOR_DEADBAND_PERCENT);
+    this->set_deadband(ActuatorChannel::TARGET_PISTON_POSITION, ACTUATOR_DEADBAND_PERCENT);
+}
+
+void ActuatorOutput::set(ActuatorChannel channel, double value)
+{
+    size_t index = static_cast<size_t>(channel);
+    this->pending[index] = value;
+    this->pending_mask |= 1u << index;
+    this->output_stats.requested++;
+}
+
+size_t ActuatorOutput::collect(ActuatorCommand *batch, EventLog *log)
+{
+    size_t len = 0;
+
+    for (size_t index = 0; index < ACTUATOR_CHANNELS; index++)
+    {
+        uint32_t bit = 1u << index;
+        if (!(this->pending_mask & bit))
+            continue;
+
+        ActuatorChannel channel = static_cast<ActuatorChannel>(index);
+        double value = this->pending[index];
+        bool changed = !(this->sent_mask & bit) || std::fabs(value - this->sent[index]) > this->deadband[index];
+        if (isControlChannel(channel) && channel != this->control)
+        {
+            // The driver switches its controller, the previous value of this
+            // channel does not apply anymore
+            changed = true;
+            this->control = channel;
+        }
+        if (!changed)
+            continue;
+
+        batch[len++] = {channel, value};
+        this->sent[index] = value;
+        this->sent_mask |= bit;
+        logEvent(log, logEventOf(channel), 0, value);
+    }
+    this->pending_mask = 0;
+
+    if (len > 0)
+    {
+        this->output_stats.sent += len;
+        this->output_stats.batches++;
+    }
+    return len;
+}
+
+void ActuatorOutput::reset()
+{
+    this->sent_mask = 0;
+    this->control = ActuatorChannel::COUNT;
+}
+
+void ActuatorOutput::set_deadband(ActuatorChannel channel, double deadband)
+{
+    this->deadband[static_cast<size_t>(channel)] = deadband;
+}
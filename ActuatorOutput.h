@@ -0,0 +1,80 @@
+#ifndef __ACTUATOR_OUTPUT_H__
+#define __ACTUATOR_OUTPUT_H__
+
+#include "EventLog.h"
+#include "Sensor.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Smallest change that is sent again, in the unit of the channel
+#define ACTUATOR_DEADBAND_TEMPERATURE 0.1
+#define ACTUATOR_DEADBAND_WEIGHT 0.1
+#define ACTUATOR_DEADBAND_PRESSURE 0.02
+#define ACTUATOR_DEADBAND_FLOW 0.02
+#define ACTUATOR_DEADBAND_PERCENT 0.1
+
+#define ACTUATOR_CHANNELS static_cast<size_t>(ActuatorChannel::COUNT)
+
+struct ActuatorOutputStats
+{
+    // Commands requested by the engine
+    size_t requested;
+    // Commands that reached the driver
+    size_t sent;
+    // apply_targets calls, one at most per flush
+    size_t batches;
+};
+
+// Collects the commands of one engine step and hands the ones that changed
+// to the driver in a single batch.
+//
+// A command is suppressed while it stays within the deadband of the value
+// last sent on its channel, so slow ramps are still followed with an error of
+// at most one deadband. Switching between pressure, flow, power and piston
+// control is always sent.
+class ActuatorOutput
+{
+public:
+    ActuatorOutput();
+
+    void set(ActuatorChannel channel, double value);
+
+    // Sends the pending commands and logs them, returns how many were sent
+    template <ProfileDriver DriverT>
+    size_t flush(DriverT *driver, EventLog *log)
+    {
+        ActuatorCommand batch[ACTUATOR_CHANNELS];
+        size_t len = this->collect(batch, log);
+        if (len > 0)
+            driver->apply_targets(batch, len);
+        return len;
+    }
+
+    // Forget what was sent, the next flush sends every pending command
+    void reset();
+
+    void set_deadband(ActuatorChannel channel, double deadband);
+
+    const ActuatorOutputStats &stats() const
+    {
+        return this->output_stats;
+    }
+
+private:
+    // Moves the changed pending commands into batch, which has room for
+    // every channel
+    size_t collect(ActuatorCommand *batch, EventLog *log);
+
+    double pending[ACTUATOR_CHANNELS];
+    double sent[ACTUATOR_CHANNELS];
+    double deadband[ACTUATOR_CHANNELS];
+    // Bit per channel
+    uint32_t pending_mask = 0;
+    uint32_t sent_mask = 0;
+    // Control channel the driver follows, COUNT before the first one
+    ActuatorChannel control = ActuatorChannel::COUNT;
+    ActuatorOutputStats output_stats = {};
+};
+
+#endif
@@ -0,0 +1,12 @@
+#include "CompiledProfile.h"
+
+CompiledProfile::CompiledProfile(const Profile *profile)
+{
+    this->samplerStages.reserve(profile->stages_len);
+    this->exitPrograms.reserve(profile->stages_len);
+    for (size_t i = 0; i < profile->stages_len; i++)
+    {
+        this->samplerStages.emplace_back(&profile->stages[i]);
+        this->exitPrograms.emplace_back(&profile->stages[i]);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef __COMPILED_PROFILE_H__
+#define __COMPILED_PROFILE_H__
+
+#include "ProfileDefinition.h"
+#include "Sampler.h"
+#include "FixedPointSampler.h"
+#include "ExitTrigger.h"
+
+#include <vector>
+
+// Build with -DPROFILE_ENGINE_FIXED_POINT to sample on the integer profile
+// encoding instead of doubles
+#ifdef PROFILE_ENGINE_FIXED_POINT
+typedef FixedPointSampler<int32_t> EngineSampler;
+#else
+typedef Sampler EngineSampler;
+#endif
+
+// Per stage runtime state derived from a Profile. It is built once before the
+// profile runs so stage transitions only have to swap pointers.
+class CompiledProfile
+{
+public:
+    CompiledProfile() {}
+    explicit CompiledProfile(const Profile *profile);
+
+    const EngineSampler::stage_type *samplerStage(size_t stage_id) const
+    {
+        return &this->samplerStages[stage_id];
+    }
+
+    const ExitProgram &exitProgram(size_t stage_id) const
+    {
+        return this->exitPrograms[stage_id];
+    }
+
+private:
+    std::vector<EngineSampler::stage_type> samplerStages;
+    std::vector<ExitProgram> exitPrograms;
+};
+
+#endif
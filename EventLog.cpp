@@ -0,0 +1,134 @@
+#include "EventLog.h"
+
+#include <chrono>
+
+EventLog engineLog;
+
+void formatLogRecord(const LogRecord &record, FILE *sink)
+{
+    switch (record.event)
+    {
+    case LogEvent::STAGE_STEP:
+        fprintf(sink, "executing stage=%d\n", static_cast<short>(record.arg));
+        break;
+    case LogEvent::STAGE_LOG_SAVED:
+        fprintf(sink, "Saving %s log for stage %ld. Timestamp = %ld\n",
+                record.value[0] == 0 ? "START" : "EXIT",
+                static_cast<long>(record.arg),
+                static_cast<long>(record.value[1]));
+        break;
+    case LogEvent::STAGE_UNREACHABLE:
+        fprintf(sink, "StageID unreachable\n");
+        break;
+    case LogEvent::NEXT_STAGE_UNREACHABLE:
+        fprintf(sink, "Next StageID unreachable\n");
+        break;
+    case LogEvent::EXIT_TRIGGER_SMALLER:
+        fprintf(sink, "ExitTrigger Type=%d: %f <= %f\n", static_cast<int>(record.arg), record.value[0], record.value[1]);
+        break;
+    case LogEvent::EXIT_TRIGGER_GREATER:
+        fprintf(sink, "ExitTrigger Type=%d: %f >= %f\n", static_cast<int>(record.arg), record.value[0], record.value[1]);
+        break;
+    case LogEvent::EXIT_TRIGGER_ACTIVATED:
+        fprintf(sink, "Exit trigger activated!\n");
+        break;
+    case LogEvent::PROFILE_END_STAGE:
+        fprintf(sink, "Profile End reached via stage end\n");
+        break;
+    case LogEvent::PROFILE_END_WEIGHT:
+        fprintf(sink, "Profile End reached via final weight hit\n");
+        break;
+    case LogEvent::SAMPLED:
+        fprintf(sink, "sampled (%ld,%f)\n", static_cast<long>(record.value[0]), record.value[1]);
+        fprintf(sink, "Setting output at %ld ms to %f\n", static_cast<long>(record.arg), record.value[1]);
+        break;
+    case LogEvent::INVALID_INPUT_TYPE:
+        fprintf(sink, "Invalid input reference type! Aborting\n");
+        break;
+    case LogEvent::INVALID_CONTROL_TYPE:
+        fprintf(sink, "Invalid control method! Aborting\n");
+        break;
+    case LogEvent::SET_TARGET_WEIGHT:
+        fprintf(sink, "Setting target weight to %f\n", record.value[0]);
+        break;
+    case LogEvent::SET_TARGET_TEMPERATURE:
+        fprintf(sink, "Setting target temperature to %f\n", record.value[0]);
+        break;
+    case LogEvent::SET_TARGET_PRESSURE:
+        fprintf(sink, "Setting target pressure to %f\n", record.value[0]);
+        break;
+    case LogEvent::SET_LIMITED_PRESSURE:
+        fprintf(sink, "Setting target pressure limit to %f\n", record.value[0]);
+        break;
+    case LogEvent::SET_TARGET_FLOW:
+        fprintf(sink, "Setting target flow to %f\n", record.value[0]);
+        break;
+    case LogEvent::SET_LIMITED_FLOW:
+        fprintf(sink, "Setting flow limit to %f\n", record.value[0]);
+        break;
+    case LogEvent::SET_TARGET_POWER:
+        fprintf(sink, "Setting target power to %f\n", record.value[0]);
+        break;
+    case LogEvent::SET_TARGET_PISTON_POSITION:
+        fprintf(sink, "Setting target piston position to %f\n", record.value[0]);
+        break;
+    }
+}
+
+EventLog::~EventLog()
+{
+    this->stop();
+}
+
+bool EventLog::push(const LogRecord &record)
+{
+    size_t head = this->head.load(std::memory_order_relaxed);
+    if (head - this->tail.load(std::memory_order_acquire) >= EVENT_LOG_CAPACITY)
+    {
+        this->dropped_records.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    this->records[head & (EVENT_LOG_CAPACITY - 1)] = record;
+    this->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool EventLog::pop(LogRecord &record)
+{
+    size_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail == this->head.load(std::memory_order_acquire))
+        return false;
+    record = this->records[tail & (EVENT_LOG_CAPACITY - 1)];
+    this->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void EventLog::drain()
+{
+    LogRecord record;
+    while (this->pop(record))
+        formatLogRecord(record, this->sink);
+}
+
+void EventLog::start(FILE *sink)
+{
+    if (this->running.exchange(true))
+        return;
+    this->sink = sink;
+    this->consumer = std::thread([this]()
+                                 {
+        while (this->running.load(std::memory_order_acquire))
+        {
+            this->drain();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        } });
+}
+
+void EventLog::stop()
+{
+    if (!this->running.exchange(false))
+        return;
+    this->consumer.join();
+    this->drain();
+    fflush(this->sink);
+}
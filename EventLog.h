@@ -0,0 +1,97 @@
+#ifndef __EVENT_LOG_H__
+#define __EVENT_LOG_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+// Capacity of the log ring in records, has to be a power of two
+#define EVENT_LOG_CAPACITY 1024
+
+enum class LogEvent : uint8_t
+{
+    STAGE_STEP,
+    STAGE_LOG_SAVED,
+    STAGE_UNREACHABLE,
+    NEXT_STAGE_UNREACHABLE,
+    EXIT_TRIGGER_SMALLER,
+    EXIT_TRIGGER_GREATER,
+    EXIT_TRIGGER_ACTIVATED,
+    PROFILE_END_STAGE,
+    PROFILE_END_WEIGHT,
+    SAMPLED,
+    INVALID_INPUT_TYPE,
+    INVALID_CONTROL_TYPE,
+    SET_TARGET_WEIGHT,
+    SET_TARGET_TEMPERATURE,
+    SET_TARGET_PRESSURE,
+    SET_LIMITED_PRESSURE,
+    SET_TARGET_FLOW,
+    SET_LIMITED_FLOW,
+    SET_TARGET_POWER,
+    SET_TARGET_PISTON_POSITION,
+};
+
+// Fixed size binary record, the meaning of the arguments depends on the event
+struct LogRecord
+{
+    LogEvent event;
+    int64_t arg;
+    double value[2];
+};
+
+void formatLogRecord(const LogRecord &record, FILE *sink);
+
+// Single producer / single consumer ring of log records.
+//
+// The control loop pushes records without locking or touching stdio, a
+// consumer thread started with start() formats and drains them. When the ring
+// is full new records are dropped and counted instead of blocking the
+// producer.
+class EventLog
+{
+public:
+    EventLog() {}
+    ~EventLog();
+
+    EventLog(const EventLog &) = delete;
+    EventLog &operator=(const EventLog &) = delete;
+
+    // Producer side
+    bool push(const LogRecord &record);
+
+    // Consumer side
+    bool pop(LogRecord &record);
+    void start(FILE *sink = stdout);
+    // Stops the consumer thread after draining everything pushed so far
+    void stop();
+
+    uint64_t dropped() const { return this->dropped_records.load(std::memory_order_relaxed); }
+
+private:
+    static_assert((EVENT_LOG_CAPACITY & (EVENT_LOG_CAPACITY - 1)) == 0, "EVENT_LOG_CAPACITY has to be a power of two");
+
+    LogRecord records[EVENT_LOG_CAPACITY];
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<uint64_t> dropped_records{0};
+
+    std::thread consumer;
+    std::atomic<bool> running{false};
+    FILE *sink = stdout;
+
+    void drain();
+};
+
+// Log of the engine driving the machine
+extern EventLog engineLog;
+
+inline void logEvent(EventLog *log, LogEvent event, int64_t arg = 0, double value0 = 0, double value1 = 0)
+{
+    if (log != nullptr)
+        log->push({event, arg, {value0, value1}});
+}
+
+#endif
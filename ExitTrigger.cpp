@@ -1,66 +1,149 @@
 
 #include "ExitTrigger.h"
 
-static double getExitInput(const ExitTrigger *exit, Driver *driver, long stage_timestamp, long profile_timestamp)
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+// A trigger that never fires on its own, evaluate() throws when it gets to it
+static CompiledExitTrigger unsupportedExitTrigger(const ExitTrigger *exit, const char *reason)
+{
+    return {EXIT_SOURCE_UNSUPPORTED, 0, 1, 0, exit->target_stage, exit, reason};
+}
+
+static CompiledExitTrigger compileExitTrigger(const ExitTrigger *exit)
 {
+    CompiledExitTrigger compiled;
+    compiled.source = EXIT_SOURCE_SENSORS;
+    compiled.target_stage = exit->target_stage;
+    compiled.trigger = exit;
+    compiled.unsupported = nullptr;
 
     switch (exit->type)
     {
     case ExitType::EXIT_PRESSURE:
-        return driver->get_sensor_data().water_pressure;
+        compiled.offset = offsetof(SensorState, water_pressure);
+        break;
 
     case ExitType::EXIT_FLOW:
-        return driver->get_sensor_data().water_flow;
+        compiled.offset = offsetof(SensorState, water_flow);
+        break;
 
     case ExitType::EXIT_TEMPERATURE:
-        return driver->get_sensor_data().stable_temperature;
+        compiled.offset = offsetof(SensorState, stable_temperature);
+        break;
 
     case ExitType::EXIT_WEIGHT:
-        return driver->get_sensor_data().weight;
+        compiled.offset = offsetof(SensorState, weight);
+        break;
 
     case ExitType::EXIT_PISTON_POSITION:
-        return driver->get_sensor_data().piston_position;
+        compiled.offset = offsetof(SensorState, piston_position);
+        break;
 
     case ExitType::EXIT_BUTTON:
-        return driver->get_button_gesture("Encoder Button", "Single Tap");
+        compiled.source = EXIT_SOURCE_TICK;
+        compiled.offset = EXIT_INPUT_BUTTON * sizeof(double);
+        break;
 
     case ExitType::EXIT_POWER:
-        throw new std::runtime_error("EXIT_POWER unimplemented");
+        return unsupportedExitTrigger(exit, "EXIT_POWER unimplemented");
 
     case ExitType::EXIT_TIME:
-        return (
-                   exit->reference == ExitReferenceType::EXIT_REF_ABSOLUTE ? profile_timestamp : stage_timestamp) /
-               1000.0;
+        compiled.source = EXIT_SOURCE_TICK;
+        compiled.offset = (exit->reference == ExitReferenceType::EXIT_REF_ABSOLUTE ? EXIT_INPUT_PROFILE_TIME : EXIT_INPUT_STAGE_TIME) * sizeof(double);
+        break;
 
     default:
-        throw new UnsupportedExitCondition("Unnown Condition");
+        return unsupportedExitTrigger(exit, "Unnown Condition");
     }
-}
 
-bool checkExitCondition(const ExitTrigger *exit, Driver *driver, long stage_timestamp, long profile_timestamp)
-{
-    double current_value = getExitInput(exit, driver, stage_timestamp, profile_timestamp);
-    double exit_value = parseExitValue(exit->value);
-
-    // printf("ExitTrigger: Comparing %f and %f == %d\n", current_value, exit_value, current_value <= exit_value);
     switch (exit->comparison)
     {
     case ExitComparison::EXIT_COMP_SMALLER:
-        if (current_value <= exit_value)
-        {
-            printf("ExitTrigger Type=%d: %f <= %f\n", static_cast<int>(exit->type), current_value, exit_value);
-            return true;
-        }
+        compiled.sign = -1;
         break;
     case ExitComparison::EXIT_COMP_GREATER:
-        if (current_value >= exit_value)
-        {
-            printf("ExitTrigger Type=%d: %f >= %f\n", static_cast<int>(exit->type), current_value, exit_value);
-            return true;
-        }
+        compiled.sign = 1;
         break;
     default:
-        throw new UnsupportedExitCondition("Unnown Comparison");
+        return unsupportedExitTrigger(exit, "Unnown Comparison");
+    }
+    compiled.threshold = compiled.sign * parseExitValue(exit->value);
+    return compiled;
+}
+
+ExitProgram::ExitProgram(const Stage *stage)
+{
+    this->triggers.reserve(stage->exitTrigger_len);
+    for (size_t i = 0; i < stage->exitTrigger_len; i++)
+    {
+        const ExitTrigger *exit = &stage->exitTrigger[i];
+        if (exit->type == ExitType::EXIT_TIME && exit->comparison == ExitComparison::EXIT_COMP_GREATER)
+        {
+            long offset = static_cast<long>(std::ceil(parseExitValue(exit->value) * 1000));
+            this->time_triggers.push_back({offset, exit->reference == ExitReferenceType::EXIT_REF_ABSOLUTE, exit});
+            continue;
+        }
+        this->triggers.push_back(compileExitTrigger(exit));
+        this->needs_button |= exit->type == ExitType::EXIT_BUTTON;
+    }
+}
+
+const CompiledExitTrigger *ExitProgram::evaluate(const SensorState &sensors, bool button_pressed, long stage_timestamp, long profile_timestamp, EventLog *log, const ExitTrigger *listed_before) const
+{
+    double tick_inputs[EXIT_INPUT_COUNT];
+    tick_inputs[EXIT_INPUT_STAGE_TIME] = stage_timestamp / 1000.0;
+    tick_inputs[EXIT_INPUT_PROFILE_TIME] = profile_timestamp / 1000.0;
+    tick_inputs[EXIT_INPUT_BUTTON] = button_pressed;
+
+    const uint8_t *sources[] = {
+        reinterpret_cast<const uint8_t *>(&sensors),
+        reinterpret_cast<const uint8_t *>(tick_inputs),
+    };
+
+    for (const CompiledExitTrigger &compiled : this->triggers)
+    {
+        // Triggers point into the stage trigger array, so they compare in profile order
+        if (listed_before != nullptr && compiled.trigger >= listed_before)
+            break;
+        if (compiled.source == EXIT_SOURCE_UNSUPPORTED)
+            throw new UnsupportedExitCondition(compiled.unsupported);
+
+        double current_value;
+        memcpy(&current_value, sources[compiled.source] + compiled.offset, sizeof(double));
+        if (current_value * compiled.sign >= compiled.threshold)
+        {
+            logEvent(log,
+                     compiled.sign < 0 ? LogEvent::EXIT_TRIGGER_SMALLER : LogEvent::EXIT_TRIGGER_GREATER,
+                     static_cast<int>(compiled.trigger->type),
+                     current_value,
+                     compiled.threshold * compiled.sign);
+            return &compiled;
+        }
+    }
+    return nullptr;
+}
+
+ExitDeadline ExitProgram::deadline(long stage_start_timestamp) const
+{
+    ExitDeadline earliest = {EXIT_NO_DEADLINE, 0, nullptr};
+    for (const TimeExitTrigger &time_trigger : this->time_triggers)
+    {
+        long deadline = time_trigger.offset + (time_trigger.is_absolute ? 0 : stage_start_timestamp);
+        if (deadline < earliest.deadline)
+            earliest = {deadline, static_cast<uint8_t>(time_trigger.trigger->target_stage), time_trigger.trigger};
+    }
+    return earliest;
+}
+
+ExitDeadline ExitProgram::passed_deadline(long stage_start_timestamp, long profile_timestamp) const
+{
+    for (const TimeExitTrigger &time_trigger : this->time_triggers)
+    {
+        long deadline = time_trigger.offset + (time_trigger.is_absolute ? 0 : stage_start_timestamp);
+        if (deadline <= profile_timestamp)
+            return {deadline, static_cast<uint8_t>(time_trigger.trigger->target_stage), time_trigger.trigger};
     }
-    return false;
+    return {EXIT_NO_DEADLINE, 0, nullptr};
 }
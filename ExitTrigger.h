@@ -4,15 +4,101 @@
 #include <map>
 #include <vector>
 #include <iostream>
+#include <climits>
 
 #include "ProfileDefinition.h"
 #include "Sensor.h"
+#include "EventLog.h"
 
 struct UnsupportedExitCondition : std::runtime_error
 {
     using std::runtime_error::runtime_error;
 };
 
-bool checkExitCondition(const ExitTrigger *exit, Driver *driver, long stage_timestamp, long profile_timestamp);
+// Per tick values exit triggers can compare against besides the sensors
+enum ExitTickInput
+{
+    EXIT_INPUT_STAGE_TIME,
+    EXIT_INPUT_PROFILE_TIME,
+    EXIT_INPUT_BUTTON,
+    EXIT_INPUT_COUNT,
+};
+
+enum ExitInputSource : uint8_t
+{
+    EXIT_SOURCE_SENSORS,
+    EXIT_SOURCE_TICK,
+    // The engine cannot evaluate the trigger, reaching it throws
+    EXIT_SOURCE_UNSUPPORTED,
+};
+
+// An ExitTrigger with everything resolved that does not change per tick.
+// The compared value is the double at offset within the source and the
+// comparison is folded into the sign, so every trigger fires on
+// value * sign >= threshold.
+struct CompiledExitTrigger
+{
+    ExitInputSource source;
+    uint32_t offset;
+    double sign;
+    double threshold;
+    uint8_t target_stage;
+    const ExitTrigger *trigger;
+    // Why the trigger is EXIT_SOURCE_UNSUPPORTED
+    const char *unsupported;
+};
+
+// Earliest point in time a stage exits through one of its time triggers
+struct ExitDeadline
+{
+    // Milliseconds since the profile start, EXIT_NO_DEADLINE if there is none
+    long deadline;
+    uint8_t target_stage;
+    const ExitTrigger *trigger;
+};
+
+#define EXIT_NO_DEADLINE LONG_MAX
+
+// All exit triggers of one stage, compiled when the profile is loaded
+class ExitProgram
+{
+public:
+    ExitProgram() {}
+    explicit ExitProgram(const Stage *stage);
+
+    // Returns the first trigger that fires in profile order, or nullptr.
+    // sensors is the snapshot of the current tick, button_pressed only has
+    // to be read from the driver when reads_button() is true. With
+    // listed_before only the triggers listed before it are evaluated.
+    // Throws UnsupportedExitCondition once it reaches a trigger the engine
+    // cannot evaluate, profile order decides if that ever happens.
+    const CompiledExitTrigger *evaluate(const SensorState &sensors, bool button_pressed, long stage_timestamp, long profile_timestamp, EventLog *log, const ExitTrigger *listed_before = nullptr) const;
+
+    bool reads_button() const
+    {
+        return this->needs_button;
+    }
+
+    // "time greater than" triggers are not part of evaluate(). They are
+    // turned into one absolute deadline when the stage is entered, ties go to
+    // the trigger listed first.
+    ExitDeadline deadline(long stage_start_timestamp) const;
+
+    // The first "time greater than" trigger in profile order whose deadline
+    // has passed at profile_timestamp, trigger is nullptr if there is none
+    ExitDeadline passed_deadline(long stage_start_timestamp, long profile_timestamp) const;
+
+private:
+    struct TimeExitTrigger
+    {
+        long offset;
+        bool is_absolute;
+        const ExitTrigger *trigger;
+    };
+
+    std::vector<CompiledExitTrigger> triggers;
+    std::vector<TimeExitTrigger> time_triggers;
+    bool needs_button = false;
+};
 
 #endif
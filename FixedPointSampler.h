@@ -0,0 +1,185 @@
+#ifndef __FIXED_POINT_SAMPLER_H__
+#define __FIXED_POINT_SAMPLER_H__
+
+#include "ProfileDefinition.h"
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Number of knots per stage used to approximate catmull and bezier curves
+#define FIXED_POINT_SAMPLER_CURVE_KNOTS SAMPLER_BEZIER_LUT_SIZE
+
+// Stage data of the FixedPointSampler.
+//
+// Knot x values are kept in deci-units of the input reference (the stage
+// point encoding times the input unit conversion) and y values in the raw
+// profile encoding shifted by fraction_bits. Every segment stores its slope as
+// a fixed point value with SLOPE_BITS fractional bits, so sampling is one
+// multiply and one shift without any division. Curved interpolations are
+// baked into linear knots when the stage is built.
+template <typename value_t = int32_t, int fraction_bits = 8>
+class FixedPointSamplerStage
+{
+    // Point values are 8 bit, shifted by fraction_bits, and segments take
+    // their difference, which needs a sign bit on top
+    static_assert(sizeof(value_t) * 8 >= 8 + fraction_bits + 1,
+                  "value_t is too narrow for 8 bit point values with fraction_bits fractional bits");
+
+public:
+    static constexpr int SLOPE_BITS = 16;
+
+    struct Knot
+    {
+        int64_t x;
+        value_t y;
+        int64_t slope;
+    };
+
+    FixedPointSamplerStage() {}
+
+    explicit FixedPointSamplerStage(const Stage *stage)
+    {
+        ControlType type = stage->dynamics.controlSelect;
+        bool is_percent = type == ControlType::CONTROL_POWER ||
+                          type == ControlType::CONTROL_PISTON_POSITION;
+        int64_t unit_conversion_factor = stage->dynamics.inputSelect == InputType::INPUT_TIME ? 1000 : 1;
+
+        this->output_scale = (is_percent ? 1.0 : 0.1) / (1 << fraction_bits);
+
+        const Point *points = stage->dynamics.points;
+        size_t points_len = stage->dynamics.points_len;
+        if (stage->dynamics.interpolation == InterpolationType::INTERPOLATION_LINEAR || points_len < 3)
+        {
+            for (size_t i = 0; i < points_len; i++)
+                this->knots.push_back({points[i].x * unit_conversion_factor, static_cast<value_t>(points[i].y.val << fraction_bits), 0});
+        }
+        else
+        {
+            this->bake_curve(stage, unit_conversion_factor, is_percent);
+        }
+
+        for (size_t i = 1; i < this->knots.size(); i++)
+        {
+            Knot &start = this->knots[i - 1];
+            const Knot &end = this->knots[i];
+            int64_t width = end.x - start.x;
+            start.slope = width > 0 ? (static_cast<int64_t>(end.y - start.y) * (1 << SLOPE_BITS)) / width : 0;
+        }
+    }
+
+    std::vector<Knot> knots;
+    double output_scale = 0;
+
+private:
+    // Evaluates the floating point sampler once per knot at build time. The
+    // result only depends on the stage, so device and host stay bit exact.
+    void bake_curve(const Stage *stage, int64_t unit_conversion_factor, bool is_percent)
+    {
+        std::vector<Point> points(
+            stage->dynamics.points,
+            stage->dynamics.points + stage->dynamics.points_len);
+        Sampler curve;
+        curve.load_new_points(stage->dynamics.controlSelect, points, unit_conversion_factor, stage->dynamics.interpolation);
+
+        int64_t start = points.front().x * unit_conversion_factor;
+        int64_t end = points.back().x * unit_conversion_factor;
+        int64_t encoding = (is_percent ? 1 : 10) * (1 << fraction_bits);
+        this->knots.push_back({start, static_cast<value_t>(points.front().y.val << fraction_bits), 0});
+        for (int i = 1; i < FIXED_POINT_SAMPLER_CURVE_KNOTS - 1; i++)
+        {
+            // Inner knots sit on whole input units, which is what Sampler::get takes
+            long input = (start + (end - start) * i / (FIXED_POINT_SAMPLER_CURVE_KNOTS - 1)) / 10;
+            int64_t x = static_cast<int64_t>(input) * 10;
+            if (x <= this->knots.back().x || x >= end)
+                continue;
+            this->knots.push_back({x, static_cast<value_t>(curve.get(input) * encoding), 0});
+        }
+        this->knots.push_back({end, static_cast<value_t>(points.back().y.val << fraction_bits), 0});
+    }
+};
+
+// Sampler working directly on the integer encoding of Point
+template <typename value_t = int32_t, int fraction_bits = 8>
+class FixedPointSampler
+{
+public:
+    typedef FixedPointSamplerStage<value_t, fraction_bits> stage_type;
+
+    FixedPointSampler() {}
+
+    // Sampled value in the engine units, matching Sampler::get
+    double get(long current_reference_input)
+    {
+        return this->get_raw(current_reference_input) * this->stage->output_scale;
+    }
+
+    // Sampled value in the profile encoding with fraction_bits fractional bits
+    value_t get_raw(long current_reference_input)
+    {
+        const std::vector<Knot> &knots = this->stage->knots;
+        if (knots.empty())
+            return 0;
+
+        int64_t x = static_cast<int64_t>(current_reference_input) * 10;
+        const Knot &first_knot = knots.front();
+        const Knot &last_knot = knots.back();
+
+        // keep the first point
+        if (knots.size() == 1 || x <= first_knot.x)
+            return first_knot.y;
+
+        // Hold the last point
+        if (x >= last_knot.x)
+            return last_knot.y;
+
+        const Knot &knot = knots[this->find_current_segment(x)];
+        return knot.y + static_cast<value_t>(((x - knot.x) * knot.slope) >> stage_type::SLOPE_BITS);
+    }
+
+    // Switches to a precomputed stage, which has to outlive its use
+    void use_stage(const stage_type *stage, int16_t stageId)
+    {
+        this->stage = stage;
+        this->segment_hint = 0;
+        this->stageId = stageId;
+    }
+
+    uint16_t stageId = -1;
+
+private:
+    typedef typename stage_type::Knot Knot;
+
+    const stage_type *stage = nullptr;
+    size_t segment_hint = 0;
+
+    // Hint and neighbour check before a binary search, see Sampler
+    size_t find_current_segment(int64_t x)
+    {
+        const std::vector<Knot> &knots = this->stage->knots;
+        size_t segments_len = knots.size() - 1;
+        size_t hint = std::min(this->segment_hint, segments_len - 1);
+        auto contains = [&](size_t segment)
+        {
+            return knots[segment].x <= x && x < knots[segment + 1].x;
+        };
+
+        if (contains(hint))
+            return hint;
+        if (hint + 1 < segments_len && contains(hint + 1))
+            return this->segment_hint = hint + 1;
+        if (hint > 0 && contains(hint - 1))
+            return this->segment_hint = hint - 1;
+
+        auto next_knot = std::upper_bound(
+            knots.begin(), knots.end(), x,
+            [](int64_t value, const Knot &knot)
+            { return value < knot.x; });
+        size_t next_index = next_knot - knots.begin();
+        this->segment_hint = std::min(next_index == 0 ? 0 : next_index - 1, segments_len - 1);
+        return this->segment_hint;
+    }
+};
+
+#endif
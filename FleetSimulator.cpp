@@ -0,0 +1,172 @@
+#include "FleetSimulator.h"
+#include "ProfileGenerator.h"
+#include "PuckSimulator.h"
+#include "ShotArchive.h"
+
+#include <algorithm>
+#include <memory>
+
+FleetSimulator::FleetSimulator(size_t threads, std::chrono::milliseconds tick, std::chrono::milliseconds max_shot_time)
+    : pool(threads), tick(tick), max_shot_time(max_shot_time)
+{
+}
+
+size_t FleetSimulator::add_profile(const std::string &json)
+{
+    this->profiles.push_back(json);
+    return this->profiles.size() - 1;
+}
+
+size_t FleetSimulator::add_scenario(const ShotScenario &scenario)
+{
+    this->scenarios.push_back(scenario);
+    return this->scenarios.size() - 1;
+}
+
+// Frees a profile when it goes out of scope. The engine frees the profile
+// it ran on itself, this covers the engine never being constructed.
+struct ProfileOwner
+{
+    Profile *profile;
+    ~ProfileOwner()
+    {
+        freeProfile(this->profile);
+    }
+};
+
+SimulationResult FleetSimulator::simulate(size_t profile_index, size_t scenario_index, ShotRecorder *recorder) const
+{
+    const ShotScenario &scenario = this->scenarios[scenario_index];
+    SimulationResult result = {};
+    result.profile = profile_index;
+    result.scenario = scenario_index;
+    if (recorder != nullptr)
+        recorder->clear();
+
+    try
+    {
+        ProfileGenerator generator(this->profiles[profile_index].c_str());
+        ProfileOwner owner = {&generator.profile};
+        PuckParameters parameters;
+        parameters.grind = scenario.grind;
+        parameters.dose = scenario.dose;
+        parameters.seed = scenario.seed;
+        PuckSimulator driver(parameters);
+        ProfileClock clock = ProfileClock::simulation();
+        SimplifiedProfileEngine engine(&generator.profile, &driver, nullptr, &clock);
+        engine.attachRecorder(recorder);
+
+        const double dt = std::chrono::duration<double>(this->tick).count();
+        const uint32_t max_ticks = this->max_shot_time / this->tick;
+        engine.start();
+        while (engine.state != ProfileState::DONE && engine.state != ProfileState::ERROR)
+        {
+            if (result.ticks >= max_ticks)
+            {
+                result.timed_out = true;
+                break;
+            }
+            engine.step();
+            bool brewing = engine.state == ProfileState::BREWING;
+            driver.advance(dt);
+            clock.advance(this->tick);
+
+            result.ticks++;
+            if (brewing)
+            {
+                result.shot_time_ms += this->tick.count();
+                result.peak_pressure = std::max(result.peak_pressure, driver.get_sensor_data().water_pressure);
+            }
+        }
+
+        result.state = engine.state;
+        result.final_weight = driver.get_sensor_data().weight;
+        for (int i = 0; i < generator.profile.stages_len; i++)
+            result.stages_entered += generator.profile.stage_log[i].valid ? 1 : 0;
+    }
+    catch (std::exception *e)
+    {
+        // Everything the engine and the profile parser throw is a heap
+        // allocated std::exception
+        delete e;
+        result.failed = true;
+        result.state = ProfileState::ERROR;
+    }
+    return result;
+}
+
+void FleetSimulator::set_archive(const std::string &path)
+{
+    this->archive_path = path;
+}
+
+std::vector<SimulationResult> FleetSimulator::run()
+{
+    size_t scenario_count = this->scenarios.size();
+    std::vector<SimulationResult> results(this->profiles.size() * scenario_count);
+    if (this->archive_path.empty())
+    {
+        // Every job owns its result slot, nothing is shared while running
+        this->pool.run(results.size(), [&](size_t job, size_t)
+                       { results[job] = this->simulate(job / scenario_count, job % scenario_count, nullptr); });
+        return results;
+    }
+
+    // Shots are recorded into one recorder per worker and encoded right
+    // away, only the small encoded blocks are kept until they are written in
+    // job order
+    std::vector<std::unique_ptr<ShotRecorder>> recorders;
+    for (size_t i = 0; i < this->pool.threads(); i++)
+        recorders.push_back(std::make_unique<ShotRecorder>(this->max_shot_time / this->tick));
+    std::vector<std::vector<uint8_t>> blocks(results.size());
+    this->pool.run(results.size(), [&](size_t job, size_t worker)
+                   {
+        ShotRecorder *recorder = recorders[worker].get();
+        results[job] = this->simulate(job / scenario_count, job % scenario_count, recorder);
+        encodeShot(*recorder, job, blocks[job]); });
+
+    ShotArchiveWriter archive(this->archive_path.c_str());
+    for (const std::vector<uint8_t> &block : blocks)
+        archive.append_encoded(block.data(), block.size());
+    archive.close();
+    return results;
+}
+
+std::vector<FleetProfileSummary> FleetSimulator::summarize(const std::vector<SimulationResult> &results) const
+{
+    std::vector<FleetProfileSummary> summaries(this->profiles.size());
+    for (const SimulationResult &result : results)
+    {
+        FleetProfileSummary &summary = summaries[result.profile];
+        summary.shots++;
+        summary.timed_out += result.timed_out;
+        summary.failed += result.failed;
+        if (result.timed_out || result.failed)
+            continue;
+
+        if (summary.completed == 0 || result.shot_time_ms < summary.min_shot_time_ms)
+            summary.min_shot_time_ms = result.shot_time_ms;
+        summary.max_shot_time_ms = std::max(summary.max_shot_time_ms, result.shot_time_ms);
+        summary.completed++;
+        summary.mean_shot_time_ms += (result.shot_time_ms - summary.mean_shot_time_ms) / summary.completed;
+        summary.mean_final_weight += (result.final_weight - summary.mean_final_weight) / summary.completed;
+        summary.max_peak_pressure = std::max(summary.max_peak_pressure, result.peak_pressure);
+    }
+    return summaries;
+}
+
+void FleetSimulator::print_summary(const std::vector<SimulationResult> &results, FILE *sink) const
+{
+    std::vector<FleetProfileSummary> summaries = this->summarize(results);
+    for (size_t i = 0; i < summaries.size(); i++)
+    {
+        const FleetProfileSummary &summary = summaries[i];
+        fprintf(sink, "Profile %zu: %zu shots, %zu completed, %zu timed out, %zu failed\n",
+                i, summary.shots, summary.completed, summary.timed_out, summary.failed);
+        if (summary.completed == 0)
+            continue;
+        fprintf(sink, "Profile %zu: shot time %ld..%ld ms (mean %.0f ms), mean weight %.1f g, peak pressure %.1f bar\n",
+                i, summary.min_shot_time_ms, summary.max_shot_time_ms, summary.mean_shot_time_ms,
+                summary.mean_final_weight, summary.max_peak_pressure);
+    }
+}
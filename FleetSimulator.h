@@ -0,0 +1,91 @@
+#ifndef __FLEET_SIMULATOR_H__
+#define __FLEET_SIMULATOR_H__
+
+#include "ShotRecorder.h"
+#include "SimplifiedProfileEngine.h"
+#include "WorkStealingPool.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Shot conditions a profile is simulated under
+struct ShotScenario
+{
+    std::string name;
+    // Puck resistance relative to a nominal grind, > 1 is finer
+    double grind;
+    // Dose in grams
+    double dose;
+    uint32_t seed;
+};
+
+struct SimulationResult
+{
+    size_t profile;
+    size_t scenario;
+    ProfileState state;
+    // The profile did not finish within the maximum shot time
+    bool timed_out;
+    // The engine threw while running the profile
+    bool failed;
+    uint32_t ticks;
+    long shot_time_ms;
+    uint8_t stages_entered;
+    double final_weight;
+    double peak_pressure;
+};
+
+struct FleetProfileSummary
+{
+    size_t shots = 0;
+    size_t completed = 0;
+    size_t timed_out = 0;
+    size_t failed = 0;
+    long min_shot_time_ms = 0;
+    long max_shot_time_ms = 0;
+    double mean_shot_time_ms = 0;
+    double mean_final_weight = 0;
+    double max_peak_pressure = 0;
+};
+
+// Runs every profile against every scenario, each shot in its own engine
+// instance on a simulated clock, spread over a work stealing thread pool.
+class FleetSimulator
+{
+public:
+    explicit FleetSimulator(
+        size_t threads = 0,
+        std::chrono::milliseconds tick = std::chrono::milliseconds(10),
+        std::chrono::milliseconds max_shot_time = std::chrono::seconds(120));
+
+    // Profiles are kept as JSON, every shot parses its own copy since the
+    // engine writes stage logs into and frees the profile it runs
+    size_t add_profile(const std::string &json);
+    size_t add_scenario(const ShotScenario &scenario);
+
+    // Records every shot and has run() write them to a shot archive at
+    // path, the shot id is the index of the result
+    void set_archive(const std::string &path);
+
+    // Results are ordered by profile, then scenario
+    std::vector<SimulationResult> run();
+
+    std::vector<FleetProfileSummary> summarize(const std::vector<SimulationResult> &results) const;
+    void print_summary(const std::vector<SimulationResult> &results, FILE *sink) const;
+
+private:
+    WorkStealingPool pool;
+    std::chrono::milliseconds tick;
+    std::chrono::milliseconds max_shot_time;
+    std::vector<std::string> profiles;
+    std::vector<ShotScenario> scenarios;
+    std::string archive_path;
+
+    // recorder may be nullptr
+    SimulationResult simulate(size_t profile, size_t scenario, ShotRecorder *recorder) const;
+};
+
+#endif
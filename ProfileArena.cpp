@@ -0,0 +1,41 @@
+#include "ProfileArena.h"
+
+#include <cstdlib>
+#include <cstring>
+
+ProfileArena::ProfileArena(void *buffer, size_t capacity)
+    : buffer(static_cast<uint8_t *>(buffer)), size(capacity), owns_buffer(false)
+{
+}
+
+ProfileArena::ProfileArena(size_t capacity)
+    : buffer(static_cast<uint8_t *>(calloc(1, capacity))), size(capacity), owns_buffer(true)
+{
+    if (this->buffer == nullptr && capacity > 0)
+        throw new std::length_error("cannot allocate memory for the profile arena");
+}
+
+ProfileArena::~ProfileArena()
+{
+    if (this->owns_buffer)
+        free(this->buffer);
+}
+
+void *ProfileArena::allocate(size_t size)
+{
+    if (size > this->size - this->offset)
+        throw new std::length_error("profile arena exhausted");
+
+    void *memory = this->buffer + this->offset;
+    this->offset += size;
+    memset(memory, 0, size);
+    return memory;
+}
+
+void *ProfileArena::release()
+{
+    if (!this->owns_buffer)
+        return nullptr;
+    this->owns_buffer = false;
+    return this->buffer;
+}
@@ -0,0 +1,45 @@
+#ifndef __PROFILE_ARENA_H__
+#define __PROFILE_ARENA_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+// Bump allocator carving all storage of a profile out of one contiguous
+// block. The block is either supplied by the caller (e.g. a static buffer) or
+// a single heap allocation handed out through release(). Individual
+// allocations are never freed, the whole block goes at once.
+class ProfileArena
+{
+public:
+    ProfileArena(void *buffer, size_t capacity);
+    explicit ProfileArena(size_t capacity);
+    ~ProfileArena();
+
+    ProfileArena(const ProfileArena &) = delete;
+    ProfileArena &operator=(const ProfileArena &) = delete;
+
+    // Returns zeroed memory, throws std::length_error once the block is exhausted
+    void *allocate(size_t size);
+
+    template <typename T>
+    T *allocate_array(size_t count)
+    {
+        return static_cast<T *>(this->allocate(sizeof(T) * count));
+    }
+
+    // Hands the heap block to the caller, who frees it with free().
+    // Returns nullptr for caller supplied buffers.
+    void *release();
+
+    size_t used() const { return this->offset; }
+    size_t capacity() const { return this->size; }
+
+private:
+    uint8_t *buffer;
+    size_t size;
+    size_t offset = 0;
+    bool owns_buffer;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "ProfileBinary.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void writeProfileBinary(const Profile *profile, const char *path)
+{
+    size_t stages_offset = sizeof(ProfileBinaryHeader);
+    size_t data_offset = stages_offset + sizeof(ProfileBinaryStage) * profile->stages_len;
+
+    std::vector<ProfileBinaryStage> stages(profile->stages_len);
+    size_t file_size = data_offset;
+    for (int i = 0; i < profile->stages_len; i++)
+    {
+        const Stage &stage = profile->stages[i];
+        ProfileBinaryStage &record = stages[i];
+        record.controlSelect = static_cast<uint8_t>(stage.dynamics.controlSelect);
+        record.inputSelect = static_cast<uint8_t>(stage.dynamics.inputSelect);
+        record.interpolation = static_cast<uint8_t>(stage.dynamics.interpolation);
+        record.points_len = stage.dynamics.points_len;
+        record.points_offset = file_size;
+        file_size += sizeof(Point) * stage.dynamics.points_len;
+        record.limits = stage.dynamics.limits;
+        record.exitTrigger_len = stage.exitTrigger_len;
+        record.exitTrigger_offset = file_size;
+        file_size += sizeof(ExitTrigger) * stage.exitTrigger_len;
+    }
+
+    ProfileBinaryHeader header = {};
+    header.magic = PROFILE_BINARY_MAGIC;
+    header.version = PROFILE_BINARY_VERSION;
+    header.byte_order = PROFILE_BINARY_BYTE_ORDER;
+    header.file_size = file_size;
+    header.stages_offset = stages_offset;
+    header.stages_len = profile->stages_len;
+    header.temperature = profile->temperature;
+    header.finalWeight = profile->finalWeight;
+    header.wait_after_heating = profile->wait_after_heating;
+    header.auto_purge = profile->auto_purge;
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+        throw new std::runtime_error("cannot open profile binary for writing");
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(stages.data(), sizeof(ProfileBinaryStage), stages.size(), file) == stages.size();
+    for (int i = 0; ok && i < profile->stages_len; i++)
+    {
+        const Stage &stage = profile->stages[i];
+        ok = fwrite(stage.dynamics.points, sizeof(Point), stage.dynamics.points_len, file) == stage.dynamics.points_len;
+        ok = ok && fwrite(stage.exitTrigger, sizeof(ExitTrigger), stage.exitTrigger_len, file) == stage.exitTrigger_len;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        throw new std::runtime_error("cannot write profile binary");
+}
+
+MappedProfile::MappedProfile(const char *path) : profile(), mapping(MAP_FAILED), mapping_size(0)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        throw new InvalidProfileBinary("cannot open profile binary");
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && static_cast<size_t>(file_stat.st_size) >= sizeof(ProfileBinaryHeader))
+    {
+        this->mapping_size = file_stat.st_size;
+        this->mapping = mmap(nullptr, this->mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (this->mapping == MAP_FAILED)
+        throw new InvalidProfileBinary("cannot map profile binary");
+
+    const uint8_t *base = static_cast<const uint8_t *>(this->mapping);
+    ProfileBinaryHeader header;
+    memcpy(&header, base, sizeof(header));
+    auto in_file = [&](size_t offset, size_t size)
+    {
+        return offset <= this->mapping_size && size <= this->mapping_size - offset;
+    };
+
+    const char *error = nullptr;
+    if (header.magic != PROFILE_BINARY_MAGIC && header.magic != __builtin_bswap32(PROFILE_BINARY_MAGIC))
+        error = "not a profile binary";
+    else if (header.byte_order != PROFILE_BINARY_BYTE_ORDER)
+        error = "profile binary was written with a different byte order";
+    else if (header.version != PROFILE_BINARY_VERSION)
+        error = "unsupported profile binary version";
+    else if (header.stages_len > MAX_STAGES)
+        error = "too many stages in profile binary";
+    else if (header.file_size != this->mapping_size ||
+             !in_file(header.stages_offset, sizeof(ProfileBinaryStage) * header.stages_len))
+        error = "truncated profile binary";
+
+    if (error == nullptr)
+        this->stages.resize(header.stages_len);
+    for (size_t i = 0; error == nullptr && i < this->stages.size(); i++)
+    {
+        ProfileBinaryStage record;
+        memcpy(&record, base + header.stages_offset + sizeof(record) * i, sizeof(record));
+        if (!in_file(record.points_offset, sizeof(Point) * record.points_len) ||
+            !in_file(record.exitTrigger_offset, sizeof(ExitTrigger) * record.exitTrigger_len))
+        {
+            error = "stage data outside of the profile binary";
+            break;
+        }
+
+        if (record.controlSelect > static_cast<uint8_t>(ControlType::CONTROL_PISTON_POSITION) ||
+            record.inputSelect > static_cast<uint8_t>(InputType::INPUT_WEIGHT) ||
+            record.interpolation > static_cast<uint8_t>(InterpolationType::INTERPOLATION_BEZIER))
+        {
+            error = "invalid stage in profile binary";
+            break;
+        }
+        // Exit triggers need no checks, every bitfield value is a valid enum
+        // entry and the engine ends the profile on a target stage past the
+        // last one, like for a parsed profile
+
+        // Points and triggers are packed, so they need no alignment
+        Stage &stage = this->stages[i];
+        stage.dynamics.controlSelect = static_cast<ControlType>(record.controlSelect);
+        stage.dynamics.inputSelect = static_cast<InputType>(record.inputSelect);
+        stage.dynamics.interpolation = static_cast<InterpolationType>(record.interpolation);
+        stage.dynamics.points_len = record.points_len;
+        stage.dynamics.points = const_cast<Point *>(reinterpret_cast<const Point *>(base + record.points_offset));
+        stage.dynamics.limits = record.limits;
+        stage.exitTrigger_len = record.exitTrigger_len;
+        stage.exitTrigger = const_cast<ExitTrigger *>(reinterpret_cast<const ExitTrigger *>(base + record.exitTrigger_offset));
+    }
+
+    if (error != nullptr)
+    {
+        munmap(this->mapping, this->mapping_size);
+        throw new InvalidProfileBinary(error);
+    }
+
+    this->stage_logs.resize(header.stages_len);
+    this->profile.storage = nullptr;
+    this->profile.startTime = 0;
+    this->profile.stages_len = header.stages_len;
+    this->profile.stages = this->stages.data();
+    this->profile.stage_log = this->stage_logs.data();
+    this->profile.temperature = header.temperature;
+    this->profile.finalWeight = header.finalWeight;
+    this->profile.wait_after_heating = header.wait_after_heating;
+    this->profile.auto_purge = header.auto_purge;
+}
+
+MappedProfile::~MappedProfile()
+{
+    munmap(this->mapping, this->mapping_size);
+}
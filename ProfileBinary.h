@@ -0,0 +1,81 @@
+#ifndef __PROFILE_BINARY_H__
+#define __PROFILE_BINARY_H__
+
+#include "ProfileDefinition.h"
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+// Compiled profile file layout, all offsets are relative to the file start:
+//
+//   ProfileBinaryHeader
+//   ProfileBinaryStage[stages_len]
+//   Point[] / ExitTrigger[] referenced by the stages
+//
+// Stages refer to their points and triggers by 32 bit offsets, so the layout
+// does not depend on the pointer size. Points and triggers are the packed
+// in-memory records, whose multi byte fields are in the byte order of the
+// writer, which the header records.
+#define PROFILE_BINARY_MAGIC 0x4245504D // "MPEB"
+#define PROFILE_BINARY_VERSION 2
+// Reads back as 0xFFFE on a machine of the other byte order
+#define PROFILE_BINARY_BYTE_ORDER 0xFEFF
+
+struct ProfileBinaryHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t byte_order;
+    uint32_t file_size;
+    uint32_t stages_offset;
+    uint8_t stages_len;
+    temperature_t temperature;
+    weight_t finalWeight;
+    uint8_t wait_after_heating : 1;
+    uint8_t auto_purge : 1;
+} __attribute__((__packed__));
+
+struct ProfileBinaryStage
+{
+    uint8_t controlSelect;
+    uint8_t inputSelect;
+    uint8_t interpolation;
+    uint8_t points_len;
+    uint32_t points_offset;
+    Limits limits;
+    uint8_t exitTrigger_len;
+    uint32_t exitTrigger_offset;
+} __attribute__((__packed__));
+
+struct InvalidProfileBinary : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+void writeProfileBinary(const Profile *profile, const char *path);
+
+// Maps a compiled profile file read only and exposes it as a Profile without
+// parsing it. Points and triggers are used in place, only the stage table is
+// rebuilt with pointers into the mapping, and the stage logs the engine
+// writes live next to it. The profile is valid for the lifetime of this
+// object.
+class MappedProfile
+{
+public:
+    explicit MappedProfile(const char *path);
+    ~MappedProfile();
+
+    MappedProfile(const MappedProfile &) = delete;
+    MappedProfile &operator=(const MappedProfile &) = delete;
+
+    Profile profile;
+
+private:
+    void *mapping;
+    size_t mapping_size;
+    std::vector<Stage> stages;
+    std::vector<StageLog> stage_logs;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __PROFILE_CLOCK_H__
+#define __PROFILE_CLOCK_H__
+
+#include <chrono>
+
+// Time source of the engine. By default it reads steady_clock, a simulated
+// clock only moves when it is advanced, which lets simulations step the
+// engine faster than real time and deterministically.
+class ProfileClock
+{
+public:
+    typedef std::chrono::steady_clock::time_point time_point;
+    typedef std::chrono::steady_clock::duration duration;
+
+    ProfileClock() : simulated(false), simulated_now() {}
+
+    static ProfileClock simulation(time_point start = time_point())
+    {
+        ProfileClock clock;
+        clock.simulated = true;
+        clock.simulated_now = start;
+        return clock;
+    }
+
+    time_point now() const
+    {
+        return this->simulated ? this->simulated_now : std::chrono::steady_clock::now();
+    }
+
+    // Only has an effect on simulated clocks
+    void advance(duration time)
+    {
+        this->simulated_now += time;
+    }
+
+    bool is_simulated() const { return this->simulated; }
+
+private:
+    bool simulated;
+    time_point simulated_now;
+};
+
+#endif
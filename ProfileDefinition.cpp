@@ -67,14 +67,6 @@ uint32_t writeExitValue(double exit)
 }
 
 void freeProfile(Profile* profile) {
-    if (profile->stages) {
-        for (int stage_index = 0; stage_index < profile->stages_len; stage_index++) {
-            const Stage *stage = &profile->stages[stage_index];
-            free(stage->exitTrigger);
-            free(stage->dynamics.points);
-        }
-        free(profile->stages);
-    }
-    if (profile->stage_log)
-        free(profile->stage_log);
+    free(profile->storage);
+    profile->storage = nullptr;
 }
\ No newline at end of file
@@ -159,6 +159,9 @@ struct Stage
 
 struct Profile
 {
+    // Single block holding stages, points, triggers and logs, or nullptr when
+    // the memory is owned by someone else
+    void *storage;
     uint32_t startTime;
     uint8_t stages_len;
     StageLog *stage_log;
@@ -1,98 +1,183 @@
 #include "ProfileGenerator.h"
+
+#include <string_view>
+
 struct InvalidJson : std::runtime_error
 {
     using std::runtime_error::runtime_error;
 };
 
-static ControlType parseControlType(const std::string &type)
+// FNV-1a, evaluated at compile time for the keywords below. Every keyword is
+// a case label of its switch, so a hash collision fails to compile and a
+// lookup is one hash and one string comparison without allocating.
+static constexpr uint32_t keywordHash(std::string_view keyword)
+{
+    uint32_t hash = 2166136261u;
+    for (char c : keyword)
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    return hash;
+}
+
+#define KEYWORD(NAME, VALUE)    \
+    case keywordHash(NAME):     \
+        if (keyword == NAME)    \
+            return VALUE;       \
+        break;
+
+static std::string_view keywordOf(JsonVariantConst value)
 {
-    if (type == "pressure")
-        return ControlType::CONTROL_PRESSURE;
-    if (type == "flow")
-        return ControlType::CONTROL_FLOW;
-    if (type == "power")
-        return ControlType::CONTROL_POWER;
-    if (type == "piston_position")
-        return ControlType::CONTROL_PISTON_POSITION;
-    throw new InvalidJson(type);
+    const char *keyword = value.as<const char *>();
+    return keyword ? keyword : "";
 }
 
-static InputType parseInputType(const std::string &type)
+static ControlType parseControlType(std::string_view keyword)
 {
-    if (type == "time")
-        return InputType::INPUT_TIME;
-    if (type == "piston_position")
-        return InputType::INPUT_PISTON_POSITION;
-    if (type == "weight")
-        return InputType::INPUT_WEIGHT;
-    throw new InvalidJson(type);
+    switch (keywordHash(keyword))
+    {
+        KEYWORD("pressure", ControlType::CONTROL_PRESSURE)
+        KEYWORD("flow", ControlType::CONTROL_FLOW)
+        KEYWORD("power", ControlType::CONTROL_POWER)
+        KEYWORD("piston_position", ControlType::CONTROL_PISTON_POSITION)
+    }
+    throw new InvalidJson(std::string(keyword));
 }
 
-static InterpolationType parseInterpolationType(const std::string &type)
+static InputType parseInputType(std::string_view keyword)
 {
-    if (type == "linear")
-        return InterpolationType::INTERPOLATION_LINEAR;
-    if (type == "catmull")
-        return InterpolationType::INTERPOLATION_CATMULL;
-    if (type == "bezier")
-        return InterpolationType::INTERPOLATION_BEZIER;
-    throw new InvalidJson(type);
+    switch (keywordHash(keyword))
+    {
+        KEYWORD("time", InputType::INPUT_TIME)
+        KEYWORD("piston_position", InputType::INPUT_PISTON_POSITION)
+        KEYWORD("weight", InputType::INPUT_WEIGHT)
+    }
+    throw new InvalidJson(std::string(keyword));
 }
 
-static ExitType parseExitType(const std::string &type)
+static InterpolationType parseInterpolationType(std::string_view keyword)
 {
-    if (type == "pressure")
-        return ExitType::EXIT_PRESSURE;
-    if (type == "flow")
-        return ExitType::EXIT_FLOW;
-    if (type == "time")
-        return ExitType::EXIT_TIME;
-    if (type == "weight")
-        return ExitType::EXIT_WEIGHT;
-    if (type == "piston_position")
-        return ExitType::EXIT_PISTON_POSITION;
-    if (type == "power")
-        return ExitType::EXIT_POWER;
-    if (type == "temperature")
-        return ExitType::EXIT_TEMPERATURE;
-    if (type == "button")
-        return ExitType::EXIT_BUTTON;
-    throw new InvalidJson(type);
+    switch (keywordHash(keyword))
+    {
+        KEYWORD("linear", InterpolationType::INTERPOLATION_LINEAR)
+        KEYWORD("catmull", InterpolationType::INTERPOLATION_CATMULL)
+        KEYWORD("bezier", InterpolationType::INTERPOLATION_BEZIER)
+    }
+    throw new InvalidJson(std::string(keyword));
 }
 
-static ExitComparison parseExitComparison(const std::string &comparison)
+static ExitType parseExitType(std::string_view keyword)
 {
-    if (comparison == "smaller")
-        return ExitComparison::EXIT_COMP_SMALLER;
-    if (comparison == "greater")
-        return ExitComparison::EXIT_COMP_GREATER;
-    throw new InvalidJson(comparison);
+    switch (keywordHash(keyword))
+    {
+        KEYWORD("pressure", ExitType::EXIT_PRESSURE)
+        KEYWORD("flow", ExitType::EXIT_FLOW)
+        KEYWORD("time", ExitType::EXIT_TIME)
+        KEYWORD("weight", ExitType::EXIT_WEIGHT)
+        KEYWORD("piston_position", ExitType::EXIT_PISTON_POSITION)
+        KEYWORD("power", ExitType::EXIT_POWER)
+        KEYWORD("temperature", ExitType::EXIT_TEMPERATURE)
+        KEYWORD("button", ExitType::EXIT_BUTTON)
+    }
+    throw new InvalidJson(std::string(keyword));
 }
 
+static ExitComparison parseExitComparison(std::string_view keyword)
+{
+    switch (keywordHash(keyword))
+    {
+        KEYWORD("smaller", ExitComparison::EXIT_COMP_SMALLER)
+        KEYWORD("greater", ExitComparison::EXIT_COMP_GREATER)
+    }
+    throw new InvalidJson(std::string(keyword));
+}
+
+#undef KEYWORD
+
 static ExitReferenceType parseExitReferenceType(bool is_relative)
 {
     return is_relative ? ExitReferenceType::EXIT_REF_SELF : ExitReferenceType::EXIT_REF_ABSOLUTE;
 }
 
-static size_t
-parseStage(const JsonObject &stageJson, Stage &stage, int16_t default_stage_exit)
+// Only the fields the engine reads are materialized, the metadata of
+// community profiles (names, authors, ids, ...) is skipped while parsing.
+static JsonDocument buildProfileFilter()
+{
+    JsonDocument filter;
+    filter["temperature"] = true;
+    filter["final_weight"] = true;
+    filter["wait_after_heating"] = true;
+    filter["auto_purge"] = true;
+
+    JsonObject stage = filter["stages"].add<JsonObject>();
+    stage["type"] = true;
+    stage["dynamics"]["points"] = true;
+    stage["dynamics"]["over"] = true;
+    stage["dynamics"]["interpolation"] = true;
+
+    JsonObject exitTrigger = stage["exit_triggers"].add<JsonObject>();
+    exitTrigger["type"] = true;
+    exitTrigger["value"] = true;
+    exitTrigger["comparison"] = true;
+    exitTrigger["relative"] = true;
+    exitTrigger["target_stage"] = true;
+
+    JsonObject limit = stage["limits"].add<JsonObject>();
+    limit["type"] = true;
+    limit["value"] = true;
+    return filter;
+}
+
+static void deserializeProfile(JsonDocument &doc, const char *json)
+{
+    static const JsonDocument filter = buildProfileFilter();
+    deserializeJson(doc, json, DeserializationOption::Filter(filter));
+}
+
+static size_t numPoints(const JsonObject &stageJson)
+{
+    // Points are only read for stages that also carry exit triggers
+    if (!stageJson.containsKey("exit_triggers"))
+        return 0;
+    return std::min(stageJson["dynamics"]["points"].as<JsonArray>().size(), static_cast<size_t>(100));
+}
+
+static size_t numExitTriggers(const JsonObject &stageJson)
+{
+    if (!stageJson.containsKey("exit_triggers"))
+        return 0;
+    return std::min(stageJson["exit_triggers"].as<JsonArray>().size(), static_cast<size_t>(100));
+}
+
+static size_t numStages(JsonDocument &doc)
 {
-    size_t bytes_allocated = 0;
+    return std::min(doc["stages"].as<JsonArray>().size(), static_cast<size_t>(MAX_STAGES));
+}
+
+static size_t requiredMemory(JsonDocument &doc)
+{
+    JsonArray json_stages = doc["stages"].as<JsonArray>();
+    size_t num_stages = numStages(doc);
+    size_t bytes = (sizeof(Stage) + sizeof(StageLog)) * num_stages;
+    for (size_t i = 0; i < num_stages; ++i)
+    {
+        JsonObject stageJson = json_stages[i].as<JsonObject>();
+        bytes += sizeof(Point) * numPoints(stageJson);
+        bytes += sizeof(ExitTrigger) * numExitTriggers(stageJson);
+    }
+    return bytes;
+}
 
-    stage.dynamics.controlSelect = parseControlType(stageJson["type"].as<std::string>());
+static void
+parseStage(const JsonObject &stageJson, Stage &stage, int16_t default_stage_exit, ProfileArena &arena)
+{
+    stage.dynamics.controlSelect = parseControlType(keywordOf(stageJson["type"]));
 
     // Allocate memory for points and parse them
     if (stageJson.containsKey("exit_triggers"))
     {
 
         JsonArray jsonPoints = stageJson["dynamics"]["points"].as<JsonArray>();
-        auto num_points = std::min(jsonPoints.size(), static_cast<size_t>(100));
-        Point *points = static_cast<Point *>(calloc(sizeof(Point), num_points));
-        if (points == nullptr)
-            throw new std::length_error("cannot allocate enough memory for all stages");
-
-        bytes_allocated += sizeof(Point) * num_points;
-        stage.dynamics.points = points;
+        auto num_points = numPoints(stageJson);
+        stage.dynamics.points = arena.allocate_array<Point>(num_points);
         stage.dynamics.points_len = num_points;
         for (size_t i = 0; i < stage.dynamics.points_len; ++i)
         {
@@ -106,27 +191,21 @@ parseStage(const JsonObject &stageJson, Stage &stage, int16_t default_stage_exit
         }
     }
 
-    stage.dynamics.interpolation = parseInterpolationType(stageJson["dynamics"]["interpolation"].as<std::string>());
-    stage.dynamics.inputSelect = parseInputType(stageJson["dynamics"]["over"].as<std::string>());
+    stage.dynamics.interpolation = parseInterpolationType(keywordOf(stageJson["dynamics"]["interpolation"]));
+    stage.dynamics.inputSelect = parseInputType(keywordOf(stageJson["dynamics"]["over"]));
 
     // Allocate memory for the exit triggers
     if (stageJson.containsKey("exit_triggers"))
     {
         JsonArray jsonExitTriggers = stageJson["exit_triggers"].as<JsonArray>();
 
-        auto num_exit_triggers = std::min(jsonExitTriggers.size(), static_cast<size_t>(100));
-        ExitTrigger *exitTriggers = static_cast<ExitTrigger *>(calloc(sizeof(ExitTrigger), num_exit_triggers));
-        if (exitTriggers == nullptr)
-            throw new std::length_error("cannot allocate enough memory for all stages");
-
-        bytes_allocated += sizeof(ExitTrigger) * num_exit_triggers;
-
-        stage.exitTrigger = exitTriggers;
+        auto num_exit_triggers = numExitTriggers(stageJson);
+        stage.exitTrigger = arena.allocate_array<ExitTrigger>(num_exit_triggers);
         stage.exitTrigger_len = num_exit_triggers;
         for (size_t i = 0; i < stage.exitTrigger_len; ++i)
         {
             JsonObject exitTriggerJson = jsonExitTriggers[i].as<JsonObject>();
-            stage.exitTrigger[i].type = parseExitType(exitTriggerJson["type"].as<std::string>());
+            stage.exitTrigger[i].type = parseExitType(keywordOf(exitTriggerJson["type"]));
             stage.exitTrigger[i].value = writeExitValue(exitTriggerJson["value"].as<double>());
             stage.exitTrigger[i].comparison = parseExitComparison(exitTriggerJson["comparison"] | "greater");
             stage.exitTrigger[i].reference = parseExitReferenceType(exitTriggerJson["relative"] | true);
@@ -139,7 +218,7 @@ parseStage(const JsonObject &stageJson, Stage &stage, int16_t default_stage_exit
         JsonArray limits = stageJson["limits"].as<JsonArray>();
         for (JsonObject limit : limits)
         {
-            auto limit_type = limit["type"].as<std::string>();
+            std::string_view limit_type = keywordOf(limit["type"]);
             if (limit_type == "pressure")
             {
                 stage.dynamics.limits.pressure = writeProfilePressure(limit["value"].as<double>());
@@ -147,23 +226,46 @@ parseStage(const JsonObject &stageJson, Stage &stage, int16_t default_stage_exit
             }
             else if (limit_type == "flow")
             {
-                stage.dynamics.limits.pressure = writeProfileFlow(limit["value"].as<double>());
+                stage.dynamics.limits.flow = writeProfileFlow(limit["value"].as<double>());
                 continue;
             }
             else
             {
-                throw new InvalidJson(limit_type);
+                throw new InvalidJson(std::string(limit_type));
             }
         }
     }
-    return bytes_allocated;
+}
+
+size_t ProfileGenerator::requiredMemory(const char *json)
+{
+    JsonDocument doc;
+    deserializeProfile(doc, json);
+    return ::requiredMemory(doc);
 }
 
 ProfileGenerator::ProfileGenerator(const char *json)
 {
     JsonDocument doc;
-    deserializeJson(doc, json);
+    deserializeProfile(doc, json);
 
+    ProfileArena arena(::requiredMemory(doc));
+    this->parse(doc, arena);
+    profile.storage = arena.release();
+}
+
+ProfileGenerator::ProfileGenerator(const char *json, void *buffer, size_t buffer_size)
+{
+    JsonDocument doc;
+    deserializeProfile(doc, json);
+
+    ProfileArena arena(buffer, buffer_size);
+    this->parse(doc, arena);
+    profile.storage = nullptr;
+}
+
+void ProfileGenerator::parse(JsonDocument &doc, ProfileArena &arena)
+{
     profile.startTime = 0;
     profile.stages_len = 0;
     profile.temperature = writeProfileTemperature(doc["temperature"].as<double>());
@@ -172,27 +274,17 @@ ProfileGenerator::ProfileGenerator(const char *json)
     profile.auto_purge = doc["auto_purge"].as<bool>();
 
     JsonArray json_stages = doc["stages"].as<JsonArray>();
-    auto num_stages = std::min(json_stages.size(), static_cast<size_t>(MAX_STAGES));
-    printf("Profile stages len= %d\n", profile.stages_len);
+    auto num_stages = numStages(doc);
 
-    Stage *stages = static_cast<Stage *>(calloc(sizeof(Stage), num_stages));
-    if (stages == nullptr)
-        throw new std::length_error("cannot allocate enough memory for all stages");
-
-    profile.stages = stages;
+    // Stages first so walking them stays within one stretch of memory
+    profile.stages = arena.allocate_array<Stage>(num_stages);
+    profile.stage_log = arena.allocate_array<StageLog>(num_stages);
     profile.stages_len = num_stages;
-    this->memoryUsed += sizeof(Stage) * profile.stages_len;
     for (int i = 0; i < profile.stages_len; ++i)
     {
         JsonObject stageJson = json_stages[i].as<JsonObject>();
         Stage &stage = profile.stages[i];
-        this->memoryUsed +=
-            parseStage(stageJson, stage, i == (profile.stages_len - 1) ? i : i + 1);
+        parseStage(stageJson, stage, i == (profile.stages_len - 1) ? i : i + 1, arena);
     }
-    StageLog *logs = static_cast<StageLog *>(calloc(sizeof(StageLog), num_stages));
-    if (logs == nullptr)
-        throw new std::length_error("cannot allocate enough memory for all stage logs");
-    //this->memoryUsed += sizeof(StageLog) * profile.stages_len;
-
-    profile.stage_log = logs;
-}
\ No newline at end of file
+    this->memoryUsed = arena.used();
+}
@@ -2,6 +2,7 @@
 #define __PROFILE_MANAGER_H__
 
 #include "ProfileDefinition.h"
+#include "ProfileArena.h"
 #include "ArduinoJson-v7.0.3.h"
 
 #include <stdexcept>
@@ -12,8 +13,18 @@ class ProfileGenerator
 {
 public:
     Profile profile;
+    // All profile storage is one heap block released by freeProfile
     ProfileGenerator(const char *json);
-    size_t memoryUsed;
+    // All profile storage is carved out of the caller supplied buffer,
+    // freeProfile leaves it untouched
+    ProfileGenerator(const char *json, void *buffer, size_t buffer_size);
+    size_t memoryUsed = 0;
+
+    // Bytes a profile needs from its arena
+    static size_t requiredMemory(const char *json);
+
+private:
+    void parse(JsonDocument &doc, ProfileArena &arena);
 };
 
 #endif // __PROFILE_MANAGER_H__
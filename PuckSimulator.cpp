@@ -0,0 +1,146 @@
+#include "PuckSimulator.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Resistance of a saturated nominal 18g puck in bar / (ml/s), 9 bar gives 2 ml/s
+#define PUCK_NOMINAL_RESISTANCE 4.5
+// Volume the hydraulics give per bar of pressure, in ml/bar
+#define PUCK_COMPLIANCE 0.5
+// Gains of the motor controller in (ml/s) / bar and (ml/s) / ml
+#define PUCK_PRESSURE_GAIN 2.0
+#define PUCK_POSITION_GAIN 5.0
+// Water the puck retains per gram of coffee, in ml/g
+#define PUCK_RETENTION 1.0
+// Resistance lost per ml of water through the puck
+#define PUCK_EROSION 0.004
+#define PUCK_MIN_EROSION 0.6
+// Time constant of the heater in s
+#define PUCK_HEATER_TIME_CONSTANT 4.0
+
+PuckSimulator::PuckSimulator(const PuckParameters &parameters)
+    : parameters(parameters),
+      // xorshift needs a non zero state
+      random_state(0x9E3779B97F4A7C15ull ^ parameters.seed)
+{
+    this->plant.water_temp = parameters.ambient_temperature;
+    this->plant.external_temperature_1 = parameters.ambient_temperature;
+    this->plant.external_temperature_2 = parameters.ambient_temperature;
+    this->plant.has_water = true;
+    this->integrate(0);
+    this->publish();
+}
+
+void PuckSimulator::advance(double dt)
+{
+    int steps = std::max(1, static_cast<int>(std::ceil(dt / PUCK_SIMULATOR_MAX_STEP)));
+    double step = dt / steps;
+    for (int i = 0; i < steps; i++)
+        this->integrate(step);
+    this->publish();
+}
+
+double PuckSimulator::puck_resistance() const
+{
+    double dose_factor = this->parameters.dose / 18.0;
+    double saturation = std::min(this->absorbed / (this->parameters.dose * PUCK_RETENTION), 1.0);
+    double erosion = std::max(1.0 - this->throughput * PUCK_EROSION, PUCK_MIN_EROSION);
+    // A dry puck lets water in easily, it only builds resistance once it swells
+    return PUCK_NOMINAL_RESISTANCE * this->parameters.grind * dose_factor * dose_factor *
+           (0.2 + 0.8 * saturation) * erosion;
+}
+
+// Flow the motor pushes for the current command, negative when retracting
+double PuckSimulator::piston_flow(double pressure, double resistance) const
+{
+    const ActuatorTargets &targets = this->targets;
+    double flow = 0;
+    switch (targets.mode)
+    {
+    case ActuatorMode::NONE:
+        return 0;
+    case ActuatorMode::PRESSURE:
+        // Feed forward of the puck flow at the current pressure
+        flow = pressure / resistance + PUCK_PRESSURE_GAIN * (targets.setpoint - pressure);
+        break;
+    case ActuatorMode::FLOW:
+        flow = targets.setpoint;
+        break;
+    case ActuatorMode::POWER:
+        flow = PUCK_SIMULATOR_MAX_FLOW * targets.setpoint / 100.0 *
+               std::max(1.0 - pressure / PUCK_SIMULATOR_STALL_PRESSURE, 0.0);
+        break;
+    case ActuatorMode::PISTON_POSITION:
+        flow = PUCK_POSITION_GAIN * (targets.setpoint - this->plant.piston_position) *
+               PUCK_SIMULATOR_CYLINDER_VOLUME / 100.0;
+        return std::clamp(flow, -PUCK_SIMULATOR_MAX_FLOW, PUCK_SIMULATOR_MAX_FLOW);
+    }
+
+    if (targets.flow_limit > 0)
+        flow = std::min(flow, targets.flow_limit);
+    if (targets.pressure_limit > 0 && pressure > targets.pressure_limit)
+        flow = std::min(flow, targets.pressure_limit / resistance + PUCK_PRESSURE_GAIN * (targets.pressure_limit - pressure));
+    return std::clamp(flow, 0.0, PUCK_SIMULATOR_MAX_FLOW);
+}
+
+void PuckSimulator::integrate(double dt)
+{
+    SensorState &plant = this->plant;
+    double resistance = this->puck_resistance();
+    double flow = this->piston_flow(plant.water_pressure, resistance);
+
+    // The piston stops at both ends of the cylinder
+    if ((plant.piston_position >= 100 && flow > 0) || (plant.piston_position <= 0 && flow < 0))
+        flow = 0;
+
+    double puck_flow = plant.water_pressure / resistance;
+    double pressure = plant.water_pressure + (flow - puck_flow) / PUCK_COMPLIANCE * dt;
+    plant.water_pressure = std::max(pressure, 0.0);
+
+    double through = puck_flow * dt;
+    double retention = this->parameters.dose * PUCK_RETENTION;
+    double soaked = std::min(through, std::max(retention - this->absorbed, 0.0));
+    this->absorbed += soaked;
+    this->throughput += through;
+    plant.weight += through - soaked;
+
+    double position = plant.piston_position + flow * dt / PUCK_SIMULATOR_CYLINDER_VOLUME * 100;
+    plant.piston_position = std::clamp(position, 0.0, 100.0);
+    plant.piston_speed = flow / PUCK_SIMULATOR_CYLINDER_VOLUME * 100;
+    plant.water_flow = flow;
+
+    // Idle heater keeps the water where it is
+    if (this->targets.temperature > 0)
+        plant.water_temp += (this->targets.temperature - plant.water_temp) * dt / PUCK_HEATER_TIME_CONSTANT;
+    plant.cylinder_temperature = plant.water_temp;
+    plant.tube_temperature = plant.water_temp;
+    plant.plunger_temperature = plant.water_temp;
+    plant.predictive_temperature = plant.water_temp;
+    plant.stable_temperature = plant.water_temp;
+    plant.temperature_up = plant.water_temp;
+    plant.temperature_middle_up = plant.water_temp;
+    plant.temperature_middle_down = plant.water_temp;
+    plant.temperature_down = plant.water_temp;
+    plant.motor_encoder = plant.piston_position;
+    plant.output_position = plant.piston_position;
+}
+
+void PuckSimulator::publish()
+{
+    SensorState sensors = this->plant;
+    double amplitude = this->parameters.noise;
+    sensors.water_pressure = std::max(sensors.water_pressure + amplitude * this->noise(), 0.0);
+    sensors.water_flow += amplitude * this->noise();
+    sensors.weight += amplitude * this->noise();
+    this->publish_sensor_data(sensors);
+}
+
+double PuckSimulator::noise()
+{
+    uint64_t x = this->random_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    this->random_state = x;
+    return static_cast<double>(x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
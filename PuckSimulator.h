@@ -0,0 +1,70 @@
+#ifndef __PUCK_SIMULATOR_H__
+#define __PUCK_SIMULATOR_H__
+
+#include "Sensor.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Piston cylinder volume in ml, piston position is in percent of it
+#define PUCK_SIMULATOR_CYLINDER_VOLUME 100.0
+// Fastest the motor moves the piston, in ml/s
+#define PUCK_SIMULATOR_MAX_FLOW 12.0
+// Pressure at which the motor stalls in power control, in bar
+#define PUCK_SIMULATOR_STALL_PRESSURE 12.0
+// Longest integration step, longer advances are split so the plant stays stable
+#define PUCK_SIMULATOR_MAX_STEP 0.005
+
+struct PuckParameters
+{
+    // Puck resistance relative to a nominal grind, > 1 is finer
+    double grind = 1.0;
+    // Dose in grams, the puck holds about as much water before it drips
+    double dose = 18.0;
+    // Amplitude of the sensor noise in bar, ml/s and g
+    double noise = 0.02;
+    // Water temperature before heating, in C
+    double ambient_temperature = 20.0;
+    uint32_t seed = 0;
+};
+
+// Simulated machine: a motor driven piston pushes water from the cylinder
+// through the puck into the cup. Pressure builds against the puck resistance
+// through the compliance of the hydraulics, the puck soaks up water before
+// the cup weight rises and erodes as water passes through it. The plant
+// follows the commands the engine sends to the Driver and publishes noisy
+// sensor readings after every advance.
+//
+// Advancing never allocates, so many plants can be stepped at kHz rates.
+class PuckSimulator : public Driver
+{
+public:
+    explicit PuckSimulator(const PuckParameters &parameters = PuckParameters());
+
+    // Moves the plant forward by dt seconds and publishes the sensors
+    void advance(double dt);
+
+    // Noise free plant state
+    const SensorState &plant_state() const
+    {
+        return this->plant;
+    }
+
+private:
+    PuckParameters parameters;
+    SensorState plant = {};
+    // Water held by the puck in ml
+    double absorbed = 0;
+    // Water that went through the puck in ml
+    double throughput = 0;
+    uint64_t random_state;
+
+    void integrate(double dt);
+    double piston_flow(double pressure, double resistance) const;
+    double puck_resistance() const;
+    void publish();
+    // Uniform noise in [-1, 1]
+    double noise();
+};
+
+#endif
@@ -1,5 +1,7 @@
 #include "Sampler.h"
 
+#include <algorithm>
+
 SamplerPoint::SamplerPoint(ControlType type, Point point, long unit_conversion_factor)
 {
     switch (type)
@@ -23,11 +25,11 @@ SamplerPoint::SamplerPoint(ControlType type, Point point, long unit_conversion_f
 
 double Sampler::get(long current_reference_input)
 {
-    SamplerPoint first_point = this->points.front();
-    SamplerPoint last_point = this->points.back();
+    const SamplerPoint &first_point = this->stage->points.front();
+    const SamplerPoint &last_point = this->stage->points.back();
 
-    if (this->points.size() == 1)
-        return this->points[0].y;
+    if (this->stage->points.size() == 1)
+        return this->stage->points[0].y;
 
     // keep the first point
     if (current_reference_input <= first_point.x)
@@ -37,102 +39,312 @@ double Sampler::get(long current_reference_input)
     if (current_reference_input >= last_point.x)
         return last_point.y;
 
-    switch (this->interpolation)
+    switch (this->stage->interpolation)
     {
     case InterpolationType::INTERPOLATION_LINEAR:
-        return this->get_value_linear(current_reference_input);
+    case InterpolationType::INTERPOLATION_CATMULL:
+        return this->get_value_polynomial(current_reference_input);
+    case InterpolationType::INTERPOLATION_BEZIER:
+        return this->get_value_bezier(current_reference_input);
     default:
         throw new UnknownInterpolationType();
     }
 }
 
-void Sampler::load_new_stage(const Stage *stage, int16_t stageId)
+void Sampler::get_batch(const long *inputs, double *out, size_t n)
 {
-    ControlType type = stage->dynamics.controlSelect;
-    InterpolationType interpolation = stage->dynamics.interpolation;
-    long unit_conversion_factor = stage->dynamics.inputSelect == InputType::INPUT_TIME ? 1000 : 1;
+    if (this->stage->points.size() == 1)
+    {
+        std::fill(out, out + n, this->stage->points[0].y);
+        return;
+    }
 
-    std::vector<Point> points(
-        stage->dynamics.points,
-        stage->dynamics.points + stage->dynamics.points_len);
+    switch (this->stage->interpolation)
+    {
+    case InterpolationType::INTERPOLATION_LINEAR:
+    case InterpolationType::INTERPOLATION_CATMULL:
+        for (size_t offset = 0; offset < n; offset += SAMPLER_BATCH_CHUNK)
+        {
+            size_t len = std::min(n - offset, static_cast<size_t>(SAMPLER_BATCH_CHUNK));
+            this->get_batch_polynomial(inputs + offset, out + offset, len);
+        }
+        break;
+    case InterpolationType::INTERPOLATION_BEZIER:
+        this->get_batch_bezier(inputs, out, n);
+        break;
+    default:
+        throw new UnknownInterpolationType();
+    }
+}
 
+void Sampler::get_batch_polynomial(const long *inputs, double *out, size_t n)
+{
+    const SamplerPoint &first_point = this->stage->points.front();
+    const SamplerPoint &last_point = this->stage->points.back();
 
-    for (Point point : points) {
-        printf("InputPoint: (%f:%f)\n", point.x / 10.0f, point.y.val / 10.0f);
+    double a[SAMPLER_BATCH_CHUNK];
+    double b[SAMPLER_BATCH_CHUNK];
+    double c[SAMPLER_BATCH_CHUNK];
+    double d[SAMPLER_BATCH_CHUNK];
+    double u[SAMPLER_BATCH_CHUNK];
+
+    // Gather the coefficients of every input into flat columns. Held points
+    // become a constant polynomial so the kernel below has no branches.
+    for (size_t i = 0; i < n; i++)
+    {
+        long input = inputs[i];
+        if (input <= first_point.x || input >= last_point.x)
+        {
+            a[i] = input <= first_point.x ? first_point.y : last_point.y;
+            b[i] = c[i] = d[i] = u[i] = 0;
+            continue;
+        }
+        size_t segment_index = this->find_current_segment(input);
+        const SamplerSegment &segment = this->stage->segments[segment_index];
+        a[i] = segment.a;
+        b[i] = segment.b;
+        c[i] = segment.c;
+        d[i] = segment.d;
+        u[i] = input - this->stage->points[segment_index].x;
     }
 
-    printf("Loading stage %d with %ld points into the sampler \n",
-           stageId,
-           points.size());
+    for (size_t i = 0; i < n; i++)
+        out[i] = a[i] + u[i] * (b[i] + u[i] * (c[i] + u[i] * d[i]));
+}
 
-    this->load_new_points(type, points, unit_conversion_factor, interpolation);
+void Sampler::get_batch_bezier(const long *inputs, double *out, size_t n)
+{
+    const double start = this->stage->points.front().x;
+    const double max_position = SAMPLER_BEZIER_LUT_SIZE - 1;
+    const double *lut = this->stage->bezier_lut.data();
 
-    for (SamplerPoint point : this->points) {
-        printf("SamplerPoint: (%f:%f)\n", point.x, point.y);
+    for (size_t i = 0; i < n; i++)
+    {
+        double position = (inputs[i] - start) * this->stage->bezier_step_inverse;
+        position = std::min(std::max(position, 0.0), max_position);
+        size_t index = std::min(static_cast<size_t>(position), static_cast<size_t>(SAMPLER_BEZIER_LUT_SIZE - 2));
+        double fraction = position - index;
+        out[i] = lut[index] + fraction * (lut[index + 1] - lut[index]);
     }
-    this->stageId = stageId;
 }
 
-void Sampler::load_new_points(
+SamplerStage::SamplerStage(const Stage *stage)
+{
+    ControlType type = stage->dynamics.controlSelect;
+    InterpolationType interpolation = stage->dynamics.interpolation;
+    long unit_conversion_factor = stage->dynamics.inputSelect == InputType::INPUT_TIME ? 1000 : 1;
+
+    std::vector<Point> points(
+        stage->dynamics.points,
+        stage->dynamics.points + stage->dynamics.points_len);
+    this->load_points(type, points, unit_conversion_factor, interpolation);
+}
+
+void SamplerStage::load_points(
     ControlType current_control,
     std::vector<Point> &points,
     long unit_conversion_factor,
     InterpolationType interpolation)
 {
     this->interpolation = interpolation;
-    this->time_series_index = 0;
     this->points.clear();
     for (Point &point : points)
     {
         SamplerPoint p(current_control, point, unit_conversion_factor);
         this->points.push_back(p);
     }
+
+    this->bezier_lut.clear();
+    switch (interpolation)
+    {
+    case InterpolationType::INTERPOLATION_LINEAR:
+        this->build_linear_segments();
+        break;
+    case InterpolationType::INTERPOLATION_CATMULL:
+        this->build_catmull_segments();
+        break;
+    case InterpolationType::INTERPOLATION_BEZIER:
+        this->segments.clear();
+        this->build_bezier_lut();
+        break;
+    default:
+        this->segments.clear();
+        break;
+    }
+}
+
+void Sampler::use_stage(const SamplerStage *stage, int16_t stageId)
+{
+    this->stage = stage;
+    this->segment_hint = 0;
+    this->stageId = stageId;
+}
+
+void Sampler::load_new_points(
+    ControlType current_control,
+    std::vector<Point> &points,
+    long unit_conversion_factor,
+    InterpolationType interpolation)
+{
+    this->owned_stage.load_points(current_control, points, unit_conversion_factor, interpolation);
+    this->use_stage(&this->owned_stage, this->stageId);
+}
+
+void SamplerStage::build_linear_segments()
+{
+    this->segments.clear();
+    for (size_t i = 1; i < this->points.size(); i++)
+    {
+        const SamplerPoint &start = this->points[i - 1];
+        const SamplerPoint &end = this->points[i];
+        double width = end.x - start.x;
+        double slope = width > 0 ? (end.y - start.y) / width : 0;
+        this->segments.push_back({start.y, slope, 0, 0});
+    }
 }
 
-void Sampler::find_current_segment(long current_value)
+// Catmull-Rom for non uniformly spaced points. The tangent at every inner
+// point is the slope between its two neighbours, the end points use the slope
+// of their only segment. Each segment is then stored as the cubic hermite
+// polynomial in u = x - x_start so get() is a single horner evaluation.
+void SamplerStage::build_catmull_segments()
 {
+    this->segments.clear();
+    size_t len = this->points.size();
+    if (len < 2)
+        return;
+
+    std::vector<double> tangents(len);
+    for (size_t i = 0; i < len; i++)
+    {
+        const SamplerPoint &prev = this->points[i == 0 ? 0 : i - 1];
+        const SamplerPoint &next = this->points[i == len - 1 ? len - 1 : i + 1];
+        double width = next.x - prev.x;
+        tangents[i] = width > 0 ? (next.y - prev.y) / width : 0;
+    }
 
-    while (current_value > this->current_segment_end)
+    for (size_t i = 1; i < len; i++)
     {
-        this->current_segment_start = this->current_segment_end;
-        this->time_series_index++;
-        if (static_cast<size_t>(time_series_index) >= this->points.size())
+        const SamplerPoint &start = this->points[i - 1];
+        const SamplerPoint &end = this->points[i];
+        double width = end.x - start.x;
+        if (width <= 0)
         {
-            this->current_segment_end = UINT64_MAX;
-            return;
+            this->segments.push_back({start.y, 0, 0, 0});
+            continue;
         }
-        this->current_segment_end = (this->points[this->time_series_index].x);
+        double slope = (end.y - start.y) / width;
+        double m0 = tangents[i - 1];
+        double m1 = tangents[i];
+        this->segments.push_back({
+            start.y,
+            m0,
+            (3 * slope - 2 * m0 - m1) / width,
+            (m0 + m1 - 2 * slope) / (width * width),
+        });
     }
+}
 
-    while (current_value < this->current_segment_start)
+// All points are the control points of a single bezier curve. The curve is
+// evaluated with de Casteljau at a fixed number of t steps and the resulting
+// polyline is resampled onto an evenly spaced x grid, so sampling never has to
+// solve the curve for t.
+void SamplerStage::build_bezier_lut()
+{
+    size_t len = this->points.size();
+    if (len < 2)
+        return;
+
+    const size_t curve_samples = SAMPLER_BEZIER_LUT_SIZE * SAMPLER_BEZIER_OVERSAMPLING;
+    std::vector<SamplerPoint> curve(curve_samples + 1);
+    std::vector<SamplerPoint> scratch(len);
+    for (size_t sample = 0; sample <= curve_samples; sample++)
     {
-        this->current_segment_end = this->current_segment_start;
-        this->time_series_index++;
-        if (time_series_index < 0)
+        double t = static_cast<double>(sample) / curve_samples;
+        scratch.assign(this->points.begin(), this->points.end());
+        for (size_t level = len - 1; level > 0; level--)
         {
-            this->current_segment_start = 0;
-            return;
+            for (size_t i = 0; i < level; i++)
+            {
+                scratch[i].x += t * (scratch[i + 1].x - scratch[i].x);
+                scratch[i].y += t * (scratch[i + 1].y - scratch[i].y);
+            }
         }
-        this->current_segment_start = (this->points[this->time_series_index].x);
+        curve[sample] = scratch[0];
+        // Enforce a monotonic x so the lookup stays a function of x
+        if (sample > 0 && curve[sample].x < curve[sample - 1].x)
+            curve[sample].x = curve[sample - 1].x;
+    }
+
+    double start = this->points.front().x;
+    double width = this->points.back().x - start;
+    double step = width / (SAMPLER_BEZIER_LUT_SIZE - 1);
+    this->bezier_step_inverse = step > 0 ? 1.0 / step : 0;
+
+    this->bezier_lut.resize(SAMPLER_BEZIER_LUT_SIZE);
+    size_t curve_index = 1;
+    for (size_t i = 0; i < SAMPLER_BEZIER_LUT_SIZE; i++)
+    {
+        double x = start + step * i;
+        while (curve_index < curve_samples && curve[curve_index].x < x)
+            curve_index++;
+
+        const SamplerPoint &left = curve[curve_index - 1];
+        const SamplerPoint &right = curve[curve_index];
+        double span = right.x - left.x;
+        double fraction = span > 0 ? (x - left.x) / span : 1;
+        fraction = std::min(std::max(fraction, 0.0), 1.0);
+        this->bezier_lut[i] = left.y + fraction * (right.y - left.y);
     }
 }
 
-double Sampler::get_value_linear(long current_reference_input)
+double Sampler::get_value_bezier(long current_reference_input)
 {
-    find_current_segment(current_reference_input);
+    double position = (current_reference_input - this->stage->points.front().x) * this->stage->bezier_step_inverse;
+    size_t index = std::min(static_cast<size_t>(position), static_cast<size_t>(SAMPLER_BEZIER_LUT_SIZE - 2));
+    double fraction = position - index;
+    return this->stage->bezier_lut[index] + fraction * (this->stage->bezier_lut[index + 1] - this->stage->bezier_lut[index]);
+}
 
-    // keep the first point
-    if (this->time_series_index < 0)
-        return this->points.front().y;
+// Returns the index of the segment [points[i], points[i + 1]) containing the
+// input. The reference usually stays in or next to the last segment, even when
+// it jitters backwards, so the hint and its neighbours are checked before
+// falling back to a binary search. Inputs outside the points are clamped to
+// the first or last segment.
+size_t Sampler::find_current_segment(long current_value)
+{
+    size_t segments_len = this->stage->segments.size();
+    if (segments_len == 0)
+        return 0;
 
-    // Hold the last point
-    if (static_cast<size_t>(time_series_index) > this->points.size())
-        return this->points.back().y;
+    size_t hint = std::min(this->segment_hint, segments_len - 1);
+    auto contains = [&](size_t segment)
+    {
+        return this->stage->points[segment].x <= current_value &&
+               (current_value < this->stage->points[segment + 1].x || segment == segments_len - 1);
+    };
+
+    if (contains(hint))
+        return hint;
+    if (hint + 1 < segments_len && contains(hint + 1))
+        return this->segment_hint = hint + 1;
+    if (hint > 0 && contains(hint - 1))
+        return this->segment_hint = hint - 1;
 
-    // Do the actual interpolation
-    double slope = (this->points[this->time_series_index].y - this->points[this->time_series_index - 1].y) /
-                   ((this->points[this->time_series_index].x) - (this->points[this->time_series_index - 1].x));
+    auto next_point = std::upper_bound(
+        this->stage->points.begin(), this->stage->points.end(), current_value,
+        [](long value, const SamplerPoint &point)
+        { return value < point.x; });
+    size_t next_index = next_point - this->stage->points.begin();
+    this->segment_hint = std::min(next_index == 0 ? 0 : next_index - 1, segments_len - 1);
+    return this->segment_hint;
+}
+
+double Sampler::get_value_polynomial(long current_reference_input)
+{
+    size_t segment_index = find_current_segment(current_reference_input);
 
-    double intercept = this->points[this->time_series_index].y - slope * (this->points[this->time_series_index].x);
-    return (slope * current_reference_input) + intercept;
+    const SamplerSegment &segment = this->stage->segments[segment_index];
+    double u = current_reference_input - this->stage->points[segment_index].x;
+    return segment.a + u * (segment.b + u * (segment.c + u * segment.d));
 }
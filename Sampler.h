@@ -2,9 +2,15 @@
 #define __SAMPLER_H__
 
 #include "ProfileDefinition.h"
-#include <array>
 #include <vector>
 
+// Resolution of the table a bezier curve is baked into when a stage is loaded
+#define SAMPLER_BEZIER_LUT_SIZE 64
+// Curve evaluations per table entry used while baking
+#define SAMPLER_BEZIER_OVERSAMPLING 4
+// Number of inputs get_batch resolves before running the evaluation kernel
+#define SAMPLER_BATCH_CHUNK 64
+
 struct UnknownInterpolationType : std::exception
 {
 };
@@ -19,13 +25,60 @@ public:
     double y;
 };
 
+// Cubic in the local segment coordinate u = x - x_start.
+// Linear segments simply leave c and d at zero.
+struct SamplerSegment
+{
+    double a;
+    double b;
+    double c;
+    double d;
+};
+
+// Everything the sampler needs for one stage, converted and precomputed once.
+// Stages can be built ahead of time and swapped into a Sampler without
+// allocating.
+class SamplerStage
+{
+public:
+    SamplerStage() {}
+    explicit SamplerStage(const Stage *stage);
+
+    void load_points(
+        ControlType current_control,
+        std::vector<Point> &points,
+        long unit_conversion_factor,
+        InterpolationType interpolation);
+
+    std::vector<SamplerPoint> points;
+    std::vector<SamplerSegment> segments;
+    InterpolationType interpolation;
+
+    // Bezier curves are resampled onto an evenly spaced x grid of
+    // SAMPLER_BEZIER_LUT_SIZE values, other stages leave it empty
+    std::vector<double> bezier_lut;
+    double bezier_step_inverse = 0;
+
+private:
+    void build_linear_segments();
+    void build_catmull_segments();
+    void build_bezier_lut();
+};
+
 class Sampler
 {
 public:
+    typedef SamplerStage stage_type;
+
     Sampler() {}
 
     double get(long current_reference_input);
-    void load_new_stage(const Stage *stage, int16_t stage_id);
+    // Gives the same results as calling get() for every input. The segments
+    // of a chunk of inputs are resolved before they are evaluated. Inputs
+    // sorted in ascending or descending order hit the segment hint every time.
+    void get_batch(const long *inputs, double *out, size_t n);
+    // Switches to a precomputed stage, which has to outlive its use
+    void use_stage(const SamplerStage *stage, int16_t stage_id);
     void load_new_points(
         ControlType current_control,
         std::vector<Point> &points,
@@ -34,15 +87,18 @@ public:
     uint16_t stageId = -1;
 
 private:
-    int32_t time_series_index = 0;
-    long current_segment_start = 0;
-    long current_segment_end = 0;
+    const SamplerStage *stage = nullptr;
+    // Backing storage for points loaded through load_new_points
+    SamplerStage owned_stage;
 
-    std::vector<SamplerPoint> points;
-    InterpolationType interpolation;
+    // Segment used by the previous lookup, checked first on the next one
+    size_t segment_hint = 0;
 
-    void find_current_segment(long current_value);
-    double get_value_linear(long current_value);
+    double get_value_bezier(long current_value);
+    void get_batch_polynomial(const long *inputs, double *out, size_t n);
+    void get_batch_bezier(const long *inputs, double *out, size_t n);
+    size_t find_current_segment(long current_value);
+    double get_value_polynomial(long current_value);
 };
 
 #endif
\ No newline at end of file
@@ -1,7 +1,13 @@
 #ifndef __SENSOR_H__
 #define __SENSOR_H__
 
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <type_traits>
 
 struct SensorState
 {
@@ -28,21 +34,216 @@ public:
     double output_position;
 };
 
+enum class ActuatorMode : uint8_t
+{
+    NONE,
+    PRESSURE,
+    FLOW,
+    POWER,
+    PISTON_POSITION,
+};
+
+// Latest commands sent to the machine. Only one of pressure, flow, power or
+// piston position is controlled at a time, the limits apply on top of it.
+struct ActuatorTargets
+{
+    ActuatorMode mode;
+    double setpoint;
+    // Limits of the controlled value, 0 means the stage has no limit
+    double pressure_limit;
+    double flow_limit;
+    double temperature;
+    double weight;
+};
+
+// Every value the engine can command, a driver writes each one separately
+enum class ActuatorChannel : uint8_t
+{
+    TARGET_TEMPERATURE,
+    TARGET_WEIGHT,
+    // A limit of 0 lifts the limit
+    PRESSURE_LIMIT,
+    FLOW_LIMIT,
+    TARGET_PRESSURE,
+    TARGET_FLOW,
+    TARGET_POWER,
+    TARGET_PISTON_POSITION,
+
+    COUNT,
+};
+
+struct ActuatorCommand
+{
+    ActuatorChannel channel;
+    double value;
+};
+
+// Sequence lock publishing a value from one writer thread to any number of
+// readers. Readers never block the writer and retry only when they raced a
+// write, so they always see a complete value. The payload is stored in
+// relaxed atomic words so concurrent copies are not a data race.
+template <typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLock needs a trivially copyable type");
+
+public:
+    // Only one thread may store at a time
+    void store(const T &value)
+    {
+        uint64_t buffer[WORDS] = {};
+        memcpy(buffer, &value, sizeof(T));
+
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++)
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    T load() const
+    {
+        uint64_t buffer[WORDS];
+        uint32_t before;
+        uint32_t after;
+        do
+        {
+            before = sequence.load(std::memory_order_acquire);
+            for (size_t i = 0; i < WORDS; i++)
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        T value;
+        memcpy(&value, buffer, sizeof(T));
+        return value;
+    }
+
+private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint32_t> sequence{0};
+    std::atomic<uint64_t> words[WORDS] = {};
+};
+
+// What the engine needs from a machine. The engine is a template on its
+// driver, so these calls are resolved at compile time and inlined into the
+// tick instead of going through a vtable.
+template <typename T>
+concept ProfileDriver = requires(T driver, const ActuatorCommand *commands, size_t len) {
+    { driver.get_sensor_data() } -> std::convertible_to<SensorState>;
+    { driver.get_button_gesture(std::string(), std::string()) } -> std::convertible_to<bool>;
+    driver.apply_targets(commands, len);
+};
+
+// Stub machine, holds the published sensors and the last commands
 class Driver
 {
 public:
-    Driver(): sensors() {}
+    Driver() {
+        sensors.store(SensorState());
+    }
 
+    // Safe to call while an acquisition thread publishes new values
     SensorState get_sensor_data() {
-        return sensors;
+        return sensors.load();
+    }
+
+    // Called by the (single) sensor acquisition thread
+    void publish_sensor_data(const SensorState &state) {
+        sensors.store(state);
     }
 
     bool get_button_gesture(std::string source, std::string gesture) {
         return false;
     }
 
-    SensorState sensors;
+    void set_target_pressure(double pressure) {
+        targets.mode = ActuatorMode::PRESSURE;
+        targets.setpoint = pressure;
+    }
+
+    void set_target_flow(double flow) {
+        targets.mode = ActuatorMode::FLOW;
+        targets.setpoint = flow;
+    }
+
+    void set_target_power(double power) {
+        targets.mode = ActuatorMode::POWER;
+        targets.setpoint = power;
+    }
+
+    void set_target_piston_position(double position) {
+        targets.mode = ActuatorMode::PISTON_POSITION;
+        targets.setpoint = position;
+    }
+
+    // 0 removes the limit
+    void set_pressure_limit(double pressure) {
+        targets.pressure_limit = pressure;
+    }
+
+    void set_flow_limit(double flow) {
+        targets.flow_limit = flow;
+    }
+
+    void set_target_temperature(double temperature) {
+        targets.temperature = temperature;
+    }
+
+    void set_target_weight(double weight) {
+        targets.weight = weight;
+    }
+
+    // Applies the commands of one engine step, a hardware driver sends them
+    // as a single transaction
+    void apply_targets(const ActuatorCommand *commands, size_t len) {
+        for (size_t i = 0; i < len; i++)
+        {
+            double value = commands[i].value;
+            switch (commands[i].channel)
+            {
+            case ActuatorChannel::TARGET_TEMPERATURE:
+                set_target_temperature(value);
+                break;
+            case ActuatorChannel::TARGET_WEIGHT:
+                set_target_weight(value);
+                break;
+            case ActuatorChannel::PRESSURE_LIMIT:
+                set_pressure_limit(value);
+                break;
+            case ActuatorChannel::FLOW_LIMIT:
+                set_flow_limit(value);
+                break;
+            case ActuatorChannel::TARGET_PRESSURE:
+                set_target_pressure(value);
+                break;
+            case ActuatorChannel::TARGET_FLOW:
+                set_target_flow(value);
+                break;
+            case ActuatorChannel::TARGET_POWER:
+                set_target_power(value);
+                break;
+            case ActuatorChannel::TARGET_PISTON_POSITION:
+                set_target_piston_position(value);
+                break;
+            case ActuatorChannel::COUNT:
+                break;
+            }
+        }
+    }
+
+    const ActuatorTargets &get_targets() const {
+        return targets;
+    }
+
+protected:
+    ActuatorTargets targets = {};
 
+private:
+    SeqLock<SensorState> sensors;
 };
 
 #endif
\ No newline at end of file
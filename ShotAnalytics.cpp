@@ -0,0 +1,232 @@
+#include "ShotAnalytics.h"
+
+#include <algorithm>
+
+static const char *exitTypeName(size_t type)
+{
+    switch (static_cast<ExitType>(type))
+    {
+    case ExitType::EXIT_PRESSURE:
+        return "pressure";
+    case ExitType::EXIT_FLOW:
+        return "flow";
+    case ExitType::EXIT_TIME:
+        return "time";
+    case ExitType::EXIT_WEIGHT:
+        return "weight";
+    case ExitType::EXIT_PISTON_POSITION:
+        return "piston_position";
+    case ExitType::EXIT_POWER:
+        return "power";
+    case ExitType::EXIT_TEMPERATURE:
+        return "temperature";
+    case ExitType::EXIT_BUTTON:
+        return "button";
+    default:
+        return "unknown";
+    }
+}
+
+void StageAggregate::add_duration(long duration_ms)
+{
+    if (this->visits == 0 || duration_ms < this->min_duration_ms)
+        this->min_duration_ms = duration_ms;
+    this->max_duration_ms = std::max(this->max_duration_ms, duration_ms);
+    this->total_duration_ms += duration_ms;
+    this->visits++;
+}
+
+void StageAggregate::merge(const StageAggregate &other)
+{
+    if (other.visits > 0)
+    {
+        if (this->visits == 0 || other.min_duration_ms < this->min_duration_ms)
+            this->min_duration_ms = other.min_duration_ms;
+        this->max_duration_ms = std::max(this->max_duration_ms, other.max_duration_ms);
+    }
+    this->visits += other.visits;
+    this->total_duration_ms += other.total_duration_ms;
+    this->peak_pressure = std::max(this->peak_pressure, other.peak_pressure);
+    this->flow_sum += other.flow_sum;
+    this->flow_samples += other.flow_samples;
+    for (size_t i = 0; i < SHOT_ANALYTICS_TRIGGERS; i++)
+        this->trigger_hits[i] += other.trigger_hits[i];
+}
+
+StageAggregate &ProfileAggregate::stage(size_t stage)
+{
+    if (stage >= this->stages.size())
+        this->stages.resize(stage + 1);
+    return this->stages[stage];
+}
+
+void ProfileAggregate::merge(const ProfileAggregate &other)
+{
+    this->shots += other.shots;
+    this->invalid_shots += other.invalid_shots;
+    this->total_shot_time_ms += other.total_shot_time_ms;
+    this->peak_pressure = std::max(this->peak_pressure, other.peak_pressure);
+    this->flow_sum += other.flow_sum;
+    this->flow_samples += other.flow_samples;
+    for (size_t i = 0; i < SHOT_ANALYTICS_EXIT_TYPES; i++)
+        this->exit_type_hits[i] += other.exit_type_hits[i];
+    for (size_t i = 0; i < other.stages.size(); i++)
+        this->stage(i).merge(other.stages[i]);
+}
+
+ShotAnalytics::ShotAnalytics(size_t threads) : pool(threads)
+{
+}
+
+void ShotAnalytics::add_archive(const MappedShotArchive *archive, size_t profile)
+{
+    this->archives.push_back({archive, profile, this->archive_jobs});
+    this->archive_jobs += archive->size();
+    this->profiles = std::max(this->profiles, profile + 1);
+}
+
+void ShotAnalytics::add_stage_logs(size_t profile, const StageLog *logs, uint8_t stages_len)
+{
+    this->stage_logs.push_back({profile, std::vector<StageLog>(logs, logs + stages_len)});
+    this->profiles = std::max(this->profiles, profile + 1);
+}
+
+void ShotAnalytics::analyze_shot(const ArchiveSource &source, size_t shot_index, ProfileAggregate &aggregate) const
+{
+    ShotArchiveShot shot = source.archive->shot(shot_index);
+
+    // Stage durations and trigger hits come from the stage exits alone,
+    // a stage is entered when the one before it exits
+    long entry_time = 0;
+    for (size_t i = 0; i < shot.events_len(); i++)
+    {
+        ShotStageEvent event = shot.event(i);
+        if (event.stage >= MAX_STAGES)
+            throw new InvalidShotArchive("stage event outside of the profile");
+        StageAggregate &stage = aggregate.stage(event.stage);
+        stage.add_duration(static_cast<long>(event.time_ms) - entry_time);
+        if (event.trigger != SHOT_NO_TRIGGER)
+        {
+            stage.trigger_hits[std::min<size_t>(event.trigger, SHOT_ANALYTICS_TRIGGERS - 1)]++;
+            aggregate.exit_type_hits[static_cast<size_t>(event.type) % SHOT_ANALYTICS_EXIT_TYPES]++;
+        }
+        entry_time = event.time_ms;
+    }
+
+    // Only the stage, pressure and flow columns are decoded
+    ShotColumnIterator stages = shot.stage();
+    ShotColumnIterator pressure = shot.column(ShotColumn::PRESSURE);
+    ShotColumnIterator flow = shot.column(ShotColumn::FLOW);
+    StageAggregate *stage = nullptr;
+    // No decode produces it, so the first row always resolves its stage
+    int64_t current_stage = INT64_MIN;
+    double peak_pressure = 0;
+    double flow_sum = 0;
+    while (stages.next() && pressure.next() && flow.next())
+    {
+        if (stages.raw() != current_stage)
+        {
+            // Decoded from the archive, a corrupt delta can put it anywhere
+            if (stages.raw() < 0 || stages.raw() >= MAX_STAGES)
+                throw new InvalidShotArchive("stage column outside of the profile");
+            current_stage = stages.raw();
+            stage = &aggregate.stage(current_stage);
+        }
+        stage->peak_pressure = std::max(stage->peak_pressure, pressure.value());
+        stage->flow_sum += flow.value();
+        stage->flow_samples++;
+        peak_pressure = std::max(peak_pressure, pressure.value());
+        flow_sum += flow.value();
+    }
+
+    aggregate.shots++;
+    aggregate.total_shot_time_ms += source.archive->entry(shot_index).end_time_ms;
+    aggregate.peak_pressure = std::max(aggregate.peak_pressure, peak_pressure);
+    aggregate.flow_sum += flow_sum;
+    aggregate.flow_samples += shot.rows();
+}
+
+void ShotAnalytics::analyze_stage_logs(const StageLogSource &source, ProfileAggregate &aggregate) const
+{
+    long shot_time = 0;
+    for (size_t i = 0; i < source.logs.size(); i++)
+    {
+        const StageLog &log = source.logs[i];
+        // Stages that were entered but never left have no end
+        if (!log.valid || log.end.timestamp < log.start.timestamp)
+            continue;
+        aggregate.stage(i).add_duration(log.end.timestamp - log.start.timestamp);
+        shot_time = std::max<long>(shot_time, log.end.timestamp);
+    }
+    aggregate.shots++;
+    aggregate.total_shot_time_ms += shot_time;
+}
+
+std::vector<ProfileAggregate> ShotAnalytics::run()
+{
+    size_t jobs = this->archive_jobs + this->stage_logs.size();
+    std::vector<std::vector<ProfileAggregate>> partials(this->pool.threads(), std::vector<ProfileAggregate>(this->profiles));
+
+    this->pool.run(jobs, [&](size_t job, size_t worker)
+                   {
+        std::vector<ProfileAggregate> &partial = partials[worker];
+        if (job >= this->archive_jobs)
+        {
+            const StageLogSource &source = this->stage_logs[job - this->archive_jobs];
+            this->analyze_stage_logs(source, partial[source.profile]);
+            return;
+        }
+
+        auto next_source = std::upper_bound(
+            this->archives.begin(), this->archives.end(), job,
+            [](size_t value, const ArchiveSource &source)
+            { return value < source.first_job; });
+        const ArchiveSource &source = *(next_source - 1);
+        try
+        {
+            // A shot that turns out to be broken halfway must not count
+            ProfileAggregate shot;
+            this->analyze_shot(source, job - source.first_job, shot);
+            partial[source.profile].merge(shot);
+        }
+        catch (InvalidShotArchive *e)
+        {
+            delete e;
+            partial[source.profile].invalid_shots++;
+        } });
+
+    std::vector<ProfileAggregate> aggregates(this->profiles);
+    for (const std::vector<ProfileAggregate> &partial : partials)
+        for (size_t i = 0; i < this->profiles; i++)
+            aggregates[i].merge(partial[i]);
+    return aggregates;
+}
+
+void ShotAnalytics::print(const std::vector<ProfileAggregate> &aggregates, FILE *sink) const
+{
+    for (size_t i = 0; i < aggregates.size(); i++)
+    {
+        const ProfileAggregate &profile = aggregates[i];
+        fprintf(sink, "Profile %zu: %zu shots (%zu invalid), mean shot time %.0f ms, peak pressure %.1f bar, mean flow %.2f ml/s\n",
+                i, profile.shots, profile.invalid_shots, profile.mean_shot_time_ms(), profile.peak_pressure, profile.mean_flow());
+        fprintf(sink, "  Exits by trigger type:");
+        for (size_t j = 0; j < SHOT_ANALYTICS_EXIT_TYPES; j++)
+        {
+            if (profile.exit_type_hits[j] > 0)
+                fprintf(sink, " %s=%zu", exitTypeName(j), profile.exit_type_hits[j]);
+        }
+        fprintf(sink, "\n");
+        for (size_t j = 0; j < profile.stages.size(); j++)
+        {
+            const StageAggregate &stage = profile.stages[j];
+            fprintf(sink, "  Stage %zu: %zu exits, duration %ld..%ld ms (mean %.0f ms), peak pressure %.1f bar, mean flow %.2f ml/s, exits per trigger:",
+                    j, stage.visits, stage.min_duration_ms, stage.max_duration_ms, stage.mean_duration_ms(), stage.peak_pressure, stage.mean_flow());
+            for (size_t k = 0; k < SHOT_ANALYTICS_TRIGGERS; k++)
+            {
+                if (stage.trigger_hits[k] > 0)
+                    fprintf(sink, " #%zu=%zu", k, stage.trigger_hits[k]);
+            }
+            fprintf(sink, "\n");
+        }
+    }
+}
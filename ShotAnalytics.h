@@ -0,0 +1,106 @@
+#ifndef __SHOT_ANALYTICS_H__
+#define __SHOT_ANALYTICS_H__
+
+#include "ProfileDefinition.h"
+#include "ShotArchive.h"
+#include "WorkStealingPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Exit trigger hits are counted per trigger index up to this many triggers,
+// later triggers share the last bucket
+#define SHOT_ANALYTICS_TRIGGERS 8
+#define SHOT_ANALYTICS_EXIT_TYPES (1 << ExitType_MAX_BITS)
+
+struct StageAggregate
+{
+    // Completed visits, their durations are included below
+    size_t visits = 0;
+    long total_duration_ms = 0;
+    long min_duration_ms = 0;
+    long max_duration_ms = 0;
+    double peak_pressure = 0;
+    double flow_sum = 0;
+    size_t flow_samples = 0;
+    // Exits per index into the exit triggers of the stage
+    size_t trigger_hits[SHOT_ANALYTICS_TRIGGERS] = {};
+
+    void add_duration(long duration_ms);
+    void merge(const StageAggregate &other);
+
+    double mean_duration_ms() const { return this->visits ? static_cast<double>(this->total_duration_ms) / this->visits : 0; }
+    double mean_flow() const { return this->flow_samples ? this->flow_sum / this->flow_samples : 0; }
+};
+
+struct ProfileAggregate
+{
+    size_t shots = 0;
+    // Archived shots that could not be decoded, they are not part of any aggregate
+    size_t invalid_shots = 0;
+    long total_shot_time_ms = 0;
+    double peak_pressure = 0;
+    double flow_sum = 0;
+    size_t flow_samples = 0;
+    // Stage exits per ExitType of the trigger that fired
+    size_t exit_type_hits[SHOT_ANALYTICS_EXIT_TYPES] = {};
+    std::vector<StageAggregate> stages;
+
+    StageAggregate &stage(size_t stage);
+    void merge(const ProfileAggregate &other);
+
+    double mean_shot_time_ms() const { return this->shots ? static_cast<double>(this->total_shot_time_ms) / this->shots : 0; }
+    double mean_flow() const { return this->flow_samples ? this->flow_sum / this->flow_samples : 0; }
+};
+
+// Aggregates shot collections per profile and per stage.
+//
+// Every shot of an archive and every set of stage logs is one job on a work
+// stealing pool. Each worker adds into its own partial aggregates, which are
+// merged once all jobs are done, so workers never share any state.
+//
+// Archived shots provide everything, stage logs only stage durations. Add a
+// shot through one of the two, not both.
+class ShotAnalytics
+{
+public:
+    explicit ShotAnalytics(size_t threads = 0);
+
+    // The archive has to outlive run()
+    void add_archive(const MappedShotArchive *archive, size_t profile);
+    // The stage logs of one finished shot, they are copied
+    void add_stage_logs(size_t profile, const StageLog *logs, uint8_t stages_len);
+
+    // One aggregate per profile index
+    std::vector<ProfileAggregate> run();
+
+    void print(const std::vector<ProfileAggregate> &aggregates, FILE *sink) const;
+
+private:
+    struct ArchiveSource
+    {
+        const MappedShotArchive *archive;
+        size_t profile;
+        // Job index of the first shot
+        size_t first_job;
+    };
+
+    struct StageLogSource
+    {
+        size_t profile;
+        std::vector<StageLog> logs;
+    };
+
+    WorkStealingPool pool;
+    size_t profiles = 0;
+    size_t archive_jobs = 0;
+    std::vector<ArchiveSource> archives;
+    std::vector<StageLogSource> stage_logs;
+
+    void analyze_shot(const ArchiveSource &source, size_t shot_index, ProfileAggregate &aggregate) const;
+    void analyze_stage_logs(const StageLogSource &source, ProfileAggregate &aggregate) const;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "ShotArchive.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+double shotColumnScale(ShotColumn column)
+{
+    switch (column)
+    {
+    case ShotColumn::PRESSURE:
+        return 1.0 / parseProfilePressure(1);
+    case ShotColumn::FLOW:
+        return 1.0 / parseProfileFlow(1);
+    case ShotColumn::WEIGHT:
+        return 1.0 / parseProfileWeight(1);
+    case ShotColumn::TEMPERATURE:
+    case ShotColumn::WATER_TEMPERATURE:
+        return 1.0 / parseProfileTemperature(1);
+    case ShotColumn::PISTON_POSITION:
+        // The profile stores whole percents, which is too coarse for a trace
+        return 10.0;
+    case ShotColumn::PISTON_SPEED:
+        // Percent per second
+        return 100.0;
+    default:
+        // Setpoints are in the unit of the stage control type
+        return 100.0;
+    }
+}
+
+static int32_t quantize(float value, double scale)
+{
+    if (std::isnan(value))
+        return SHOT_ARCHIVE_MISSING;
+    double scaled = std::round(value * scale);
+    return static_cast<int32_t>(std::clamp<double>(scaled, INT32_MIN + 1, INT32_MAX));
+}
+
+static void encodeTimeColumn(const uint32_t *time_ms, size_t rows, std::vector<uint8_t> &out)
+{
+    int64_t previous = 0;
+    int64_t previous_delta = 0;
+    for (size_t i = 0; i < rows; i++)
+    {
+        int64_t delta = static_cast<int64_t>(time_ms[i]) - previous;
+        writeVarint(out, zigzagEncode(delta - previous_delta));
+        previous = time_ms[i];
+        previous_delta = delta;
+    }
+}
+
+template <typename T, typename Quantize>
+static void encodeDeltaColumn(const T *values, size_t rows, Quantize quantize, std::vector<uint8_t> &out)
+{
+    int64_t previous = 0;
+    for (size_t i = 0; i < rows; i++)
+    {
+        int64_t value = quantize(values[i]);
+        writeVarint(out, zigzagEncode(value - previous));
+        previous = value;
+    }
+}
+
+void encodeShot(const ShotRecorder &recorder, uint64_t shot_id, std::vector<uint8_t> &out)
+{
+    size_t rows = recorder.size();
+    // A count the header cannot hold would shift every column after it
+    if (rows > UINT32_MAX || recorder.events_len() > UINT16_MAX)
+        throw new std::runtime_error("shot too large for the shot archive");
+    ShotArchiveShotHeader header = {};
+    header.shot_id = shot_id;
+    header.rows = rows;
+    header.events = recorder.events_len();
+
+    size_t header_offset = out.size();
+    out.resize(header_offset + sizeof(header));
+    const uint8_t *events = reinterpret_cast<const uint8_t *>(recorder.events());
+    out.insert(out.end(), events, events + sizeof(ShotStageEvent) * recorder.events_len());
+
+    size_t start = out.size();
+    encodeTimeColumn(recorder.time_ms(), rows, out);
+    header.column_bytes[0] = out.size() - start;
+
+    start = out.size();
+    encodeDeltaColumn(recorder.stage(), rows, [](uint8_t stage)
+                      { return stage; }, out);
+    header.column_bytes[1] = out.size() - start;
+
+    for (size_t i = 0; i < SHOT_COLUMNS; i++)
+    {
+        ShotColumn column = static_cast<ShotColumn>(i);
+        double scale = shotColumnScale(column);
+        start = out.size();
+        encodeDeltaColumn(recorder.column(column), rows, [scale](float value)
+                          { return quantize(value, scale); }, out);
+        header.column_bytes[i + 2] = out.size() - start;
+    }
+
+    memcpy(out.data() + header_offset, &header, sizeof(header));
+}
+
+ShotArchiveWriter::ShotArchiveWriter(const char *path)
+{
+    this->file = fopen(path, "wb");
+    if (this->file == nullptr)
+        throw new std::runtime_error("cannot open shot archive for writing");
+
+    // Completed by close()
+    ShotArchiveHeader header = {};
+    this->write(&header, sizeof(header));
+}
+
+ShotArchiveWriter::~ShotArchiveWriter()
+{
+    if (this->file != nullptr)
+        fclose(this->file);
+}
+
+void ShotArchiveWriter::write(const void *data, size_t len)
+{
+    if (len > 0 && fwrite(data, len, 1, this->file) != 1)
+        throw new std::runtime_error("cannot write shot archive");
+    this->offset += len;
+}
+
+void ShotArchiveWriter::append(const ShotRecorder &recorder, uint64_t shot_id)
+{
+    size_t rows = recorder.size();
+    ShotArchiveIndexEntry entry = {};
+    entry.offset = this->offset;
+    entry.shot_id = shot_id;
+    entry.rows = rows;
+    entry.start_time_ms = rows > 0 ? recorder.time_ms()[0] : 0;
+    entry.end_time_ms = rows > 0 ? recorder.time_ms()[rows - 1] : 0;
+
+    this->buffer.clear();
+    encodeShot(recorder, shot_id, this->buffer);
+    this->write(this->buffer.data(), this->buffer.size());
+    this->index.push_back(entry);
+}
+
+void ShotArchiveWriter::append_encoded(const uint8_t *block, size_t len)
+{
+    // The time span for the index is only in the time column
+    ShotArchiveShot shot(block, len);
+    ShotArchiveIndexEntry entry = {};
+    entry.offset = this->offset;
+    entry.shot_id = shot.id();
+    entry.rows = shot.rows();
+    ShotColumnIterator time = shot.time();
+    if (time.next())
+        entry.start_time_ms = time.raw();
+    time.skip_to(shot.rows());
+    entry.end_time_ms = time.raw();
+
+    this->write(block, len);
+    this->index.push_back(entry);
+}
+
+void ShotArchiveWriter::close()
+{
+    ShotArchiveHeader header = {};
+    header.magic = SHOT_ARCHIVE_MAGIC;
+    header.version = SHOT_ARCHIVE_VERSION;
+    header.columns = SHOT_COLUMNS;
+    header.shots = this->index.size();
+    header.index_offset = this->offset;
+
+    this->write(this->index.data(), sizeof(ShotArchiveIndexEntry) * this->index.size());
+    bool ok = fseek(this->file, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(header), 1, this->file) == 1;
+    ok = fclose(this->file) == 0 && ok;
+    this->file = nullptr;
+    if (!ok)
+        throw new std::runtime_error("cannot write shot archive");
+}
+
+ShotArchiveShot::ShotArchiveShot(const uint8_t *block, size_t len)
+{
+    if (len < sizeof(this->header))
+        throw new InvalidShotArchive("truncated shot header");
+    memcpy(&this->header, block, sizeof(this->header));
+
+    size_t offset = sizeof(this->header);
+    this->events_data = block + offset;
+    offset += sizeof(ShotStageEvent) * this->header.events;
+    for (size_t i = 0; i < SHOT_COLUMNS + 2; i++)
+    {
+        this->columns[i] = block + offset;
+        offset += this->header.column_bytes[i];
+    }
+    if (offset > len)
+        throw new InvalidShotArchive("shot columns outside of the shot archive");
+}
+
+ShotStageEvent ShotArchiveShot::event(size_t index) const
+{
+    // Events are not aligned within the mapping
+    ShotStageEvent event;
+    memcpy(&event, this->events_data + sizeof(ShotStageEvent) * index, sizeof(event));
+    return event;
+}
+
+ShotColumnIterator ShotArchiveShot::time() const
+{
+    return ShotColumnIterator(this->columns[0], this->header.column_bytes[0], this->header.rows, true, 1);
+}
+
+ShotColumnIterator ShotArchiveShot::stage() const
+{
+    return ShotColumnIterator(this->columns[1], this->header.column_bytes[1], this->header.rows, false, 1);
+}
+
+ShotColumnIterator ShotArchiveShot::column(ShotColumn column) const
+{
+    size_t index = static_cast<size_t>(column) + 2;
+    return ShotColumnIterator(this->columns[index], this->header.column_bytes[index], this->header.rows, false, shotColumnScale(column));
+}
+
+ShotRowRange ShotArchiveShot::rows_between(uint32_t start_ms, uint32_t end_ms) const
+{
+    ShotRowRange range = {this->header.rows, this->header.rows};
+    ShotColumnIterator time = this->time();
+    while (time.next())
+    {
+        if (time.raw() >= start_ms && range.first == this->header.rows)
+            range.first = time.row();
+        if (time.raw() >= end_ms)
+        {
+            range.last = time.row();
+            break;
+        }
+    }
+    range.last = std::max(range.first, range.last);
+    return range;
+}
+
+ShotRowRange ShotArchiveShot::stage_rows(uint8_t stage) const
+{
+    ShotRowRange range = {this->header.rows, this->header.rows};
+    ShotColumnIterator stages = this->stage();
+    while (stages.next())
+    {
+        bool in_stage = stages.raw() == stage;
+        if (in_stage && range.first == this->header.rows)
+            range.first = stages.row();
+        if (!in_stage && range.first != this->header.rows)
+        {
+            range.last = stages.row();
+            break;
+        }
+    }
+    return range;
+}
+
+size_t ShotArchiveShot::decode(ShotColumn column, ShotRowRange range, double *out) const
+{
+    uint32_t last = std::min(range.last, this->header.rows);
+    if (range.first >= last)
+        return 0;
+
+    ShotColumnIterator values = this->column(column);
+    values.skip_to(range.first);
+    size_t len = 0;
+    while (len < last - range.first && values.next())
+        out[len++] = values.value();
+    return len;
+}
+
+MappedShotArchive::MappedShotArchive(const char *path) : mapping(MAP_FAILED), mapping_size(0)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        throw new InvalidShotArchive("cannot open shot archive");
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && static_cast<size_t>(file_stat.st_size) >= sizeof(ShotArchiveHeader))
+    {
+        this->mapping_size = file_stat.st_size;
+        this->mapping = mmap(nullptr, this->mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (this->mapping == MAP_FAILED)
+        throw new InvalidShotArchive("cannot map shot archive");
+
+    ShotArchiveHeader header;
+    memcpy(&header, this->mapping, sizeof(header));
+
+    const char *error = nullptr;
+    if (header.magic != SHOT_ARCHIVE_MAGIC)
+        error = "not a shot archive";
+    else if (header.version != SHOT_ARCHIVE_VERSION || header.columns != SHOT_COLUMNS)
+        error = "unsupported shot archive version";
+    else if (header.index_offset < sizeof(header) || header.index_offset > this->mapping_size ||
+             (this->mapping_size - header.index_offset) / sizeof(ShotArchiveIndexEntry) < header.shots)
+        error = "truncated shot archive";
+
+    this->shots = header.shots;
+    this->index_offset = header.index_offset;
+    uint64_t previous_offset = sizeof(header);
+    for (size_t i = 0; error == nullptr && i < this->shots; i++)
+    {
+        uint64_t offset = this->entry(i).offset;
+        if (offset < previous_offset || offset >= this->index_offset)
+            error = "shot outside of the shot archive";
+        previous_offset = offset;
+    }
+
+    if (error != nullptr)
+    {
+        munmap(this->mapping, this->mapping_size);
+        throw new InvalidShotArchive(error);
+    }
+}
+
+MappedShotArchive::~MappedShotArchive()
+{
+    munmap(this->mapping, this->mapping_size);
+}
+
+ShotArchiveIndexEntry MappedShotArchive::entry(size_t index) const
+{
+    ShotArchiveIndexEntry entry;
+    const uint8_t *base = static_cast<const uint8_t *>(this->mapping);
+    memcpy(&entry, base + this->index_offset + sizeof(entry) * index, sizeof(entry));
+    return entry;
+}
+
+ShotArchiveShot MappedShotArchive::shot(size_t index) const
+{
+    const uint8_t *base = static_cast<const uint8_t *>(this->mapping);
+    uint64_t offset = this->entry(index).offset;
+    uint64_t end = index + 1 < this->shots ? this->entry(index + 1).offset : this->index_offset;
+    return ShotArchiveShot(base + offset, end - offset);
+}
@@ -0,0 +1,265 @@
+#ifndef __SHOT_ARCHIVE_H__
+#define __SHOT_ARCHIVE_H__
+
+#include "ShotRecorder.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+// Shot archive file layout, all offsets are relative to the file start:
+//
+//   ShotArchiveHeader
+//   per shot:
+//     ShotArchiveShotHeader
+//     ShotStageEvent[events]
+//     time column, stage column, then one column per ShotColumn
+//   ShotArchiveIndexEntry[shots]   starts at index_offset
+//
+// Values are quantized to integers, the first row is stored as is and every
+// further row as the difference to the previous one. Timestamps store the
+// difference of those differences, which is zero for a steady tick. Every
+// number is zigzag mapped and written as a LEB128 varint, so a steady signal
+// costs one byte per tick. The column sizes in the shot header allow skipping
+// to any column without decoding the ones before it.
+#define SHOT_ARCHIVE_MAGIC 0x4153504D // "MPSA"
+#define SHOT_ARCHIVE_VERSION 2
+
+// Quantized value of setpoints that were not sampled (NaN)
+#define SHOT_ARCHIVE_MISSING INT32_MIN
+
+struct ShotArchiveHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t columns;
+    uint8_t reserved;
+    uint32_t shots;
+    uint64_t index_offset;
+} __attribute__((__packed__));
+
+struct ShotArchiveShotHeader
+{
+    uint64_t shot_id;
+    uint32_t rows;
+    uint16_t events;
+    uint16_t reserved;
+    // Encoded sizes of the time column, the stage column and the ShotColumns
+    uint32_t column_bytes[SHOT_COLUMNS + 2];
+} __attribute__((__packed__));
+
+struct ShotArchiveIndexEntry
+{
+    uint64_t offset;
+    uint64_t shot_id;
+    uint32_t rows;
+    uint32_t start_time_ms;
+    uint32_t end_time_ms;
+} __attribute__((__packed__));
+
+struct InvalidShotArchive : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Quantization steps per unit of each column. Pressure, flow, weight and
+// temperature use the deci-unit resolution of the profile encoding.
+double shotColumnScale(ShotColumn column);
+
+inline uint64_t zigzagEncode(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzagDecode(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline void writeVarint(std::vector<uint8_t> &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Advances data past the varint, returns false when it runs past end
+inline bool readVarint(const uint8_t *&data, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *data++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Appends the encoded shot block (shot header, events and columns) to out.
+// Throws if the shot has more rows or events than the header can count.
+void encodeShot(const ShotRecorder &recorder, uint64_t shot_id, std::vector<uint8_t> &out);
+
+// Writes shots to an archive file one after another. The index is written
+// by close(), an archive without it is rejected by readers.
+class ShotArchiveWriter
+{
+public:
+    explicit ShotArchiveWriter(const char *path);
+    ~ShotArchiveWriter();
+
+    ShotArchiveWriter(const ShotArchiveWriter &) = delete;
+    ShotArchiveWriter &operator=(const ShotArchiveWriter &) = delete;
+
+    void append(const ShotRecorder &recorder, uint64_t shot_id);
+    // Appends a shot block made by encodeShot, e.g. on another thread
+    void append_encoded(const uint8_t *block, size_t len);
+    void close();
+
+    // Bytes written so far, including the header
+    uint64_t size() const { return this->offset; }
+
+private:
+    FILE *file;
+    uint64_t offset = 0;
+    std::vector<ShotArchiveIndexEntry> index;
+    // Reused between shots
+    std::vector<uint8_t> buffer;
+
+    void write(const void *data, size_t len);
+};
+
+// Decodes one column of a shot front to back. Every value depends on all
+// deltas before it, so rows before a requested range are still summed, but
+// without converting or storing them.
+class ShotColumnIterator
+{
+public:
+    ShotColumnIterator() {}
+    ShotColumnIterator(const uint8_t *data, size_t len, uint32_t rows, bool delta_of_delta, double scale)
+        : data(data), end(data + len), rows(rows), delta_of_delta(delta_of_delta), scale(scale) {}
+
+    // Moves to the next row, returns false after the last one
+    bool next()
+    {
+        if (this->position == this->rows)
+            return false;
+
+        uint64_t encoded;
+        if (!readVarint(this->data, this->end, encoded))
+            throw new InvalidShotArchive("truncated shot column");
+        if (this->delta_of_delta)
+        {
+            this->delta += zigzagDecode(encoded);
+            this->current += this->delta;
+        }
+        else
+        {
+            this->current += zigzagDecode(encoded);
+        }
+        this->position++;
+        return true;
+    }
+
+    // Decodes up to row, so the next call to next() moves onto it
+    void skip_to(uint32_t row)
+    {
+        while (this->position < row && this->next())
+        {
+        }
+    }
+
+    // Row of the current value
+    uint32_t row() const { return this->position - 1; }
+    // Quantized value as stored
+    int64_t raw() const { return this->current; }
+    // Value in the unit of the column, NaN if it was not recorded
+    double value() const
+    {
+        return this->current == SHOT_ARCHIVE_MISSING ? NAN : this->current / this->scale;
+    }
+
+private:
+    const uint8_t *data = nullptr;
+    const uint8_t *end = nullptr;
+    uint32_t rows = 0;
+    uint32_t position = 0;
+    bool delta_of_delta = false;
+    double scale = 1;
+    int64_t current = 0;
+    int64_t delta = 0;
+};
+
+// Rows [first, last) of a shot
+struct ShotRowRange
+{
+    uint32_t first;
+    uint32_t last;
+};
+
+// One shot of a mapped archive. Nothing is decoded until a column is asked
+// for, and only that column is touched.
+class ShotArchiveShot
+{
+public:
+    // Throws InvalidShotArchive if the columns do not fit into the block
+    ShotArchiveShot(const uint8_t *block, size_t len);
+
+    uint64_t id() const { return this->header.shot_id; }
+    uint32_t rows() const { return this->header.rows; }
+
+    size_t events_len() const { return this->header.events; }
+    ShotStageEvent event(size_t index) const;
+
+    ShotColumnIterator time() const;
+    ShotColumnIterator stage() const;
+    ShotColumnIterator column(ShotColumn column) const;
+
+    // Rows with a timestamp in [start_ms, end_ms), only decodes the time column
+    ShotRowRange rows_between(uint32_t start_ms, uint32_t end_ms) const;
+    // Rows of the first visit of stage, only decodes the stage column
+    ShotRowRange stage_rows(uint8_t stage) const;
+
+    // Writes the values of column for the rows in range to out, returns how
+    // many were written. The range is clamped to the rows of the shot, an
+    // empty or reversed one writes nothing.
+    size_t decode(ShotColumn column, ShotRowRange range, double *out) const;
+
+private:
+    ShotArchiveShotHeader header;
+    const uint8_t *events_data;
+    const uint8_t *columns[SHOT_COLUMNS + 2];
+};
+
+// Maps a shot archive read only. The index is checked when the archive is
+// opened, a shot when it is accessed. Shots are valid for the lifetime of
+// this object.
+class MappedShotArchive
+{
+public:
+    explicit MappedShotArchive(const char *path);
+    ~MappedShotArchive();
+
+    MappedShotArchive(const MappedShotArchive &) = delete;
+    MappedShotArchive &operator=(const MappedShotArchive &) = delete;
+
+    // Number of shots
+    size_t size() const { return this->shots; }
+    ShotArchiveIndexEntry entry(size_t index) const;
+    ShotArchiveShot shot(size_t index) const;
+
+private:
+    void *mapping;
+    size_t mapping_size;
+    size_t shots = 0;
+    uint64_t index_offset = 0;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "ShotRecorder.h"
+
+const char *shotColumnName(ShotColumn column)
+{
+    switch (column)
+    {
+    case ShotColumn::SETPOINT:
+        return "setpoint";
+    case ShotColumn::PRESSURE:
+        return "pressure";
+    case ShotColumn::FLOW:
+        return "flow";
+    case ShotColumn::WEIGHT:
+        return "weight";
+    case ShotColumn::PISTON_POSITION:
+        return "piston_position";
+    case ShotColumn::TEMPERATURE:
+        return "temperature";
+    case ShotColumn::WATER_TEMPERATURE:
+        return "water_temperature";
+    case ShotColumn::PISTON_SPEED:
+        return "piston_speed";
+    default:
+        return "unknown";
+    }
+}
+
+static size_t requiredMemory(size_t capacity, size_t event_capacity)
+{
+    return event_capacity * sizeof(ShotStageEvent) +
+           capacity * (sizeof(uint32_t) + SHOT_COLUMNS * sizeof(float) + sizeof(uint8_t));
+}
+
+// Columns are allocated from the widest alignment down, so the bump
+// allocator keeps every one of them aligned
+ShotRecorder::ShotRecorder(size_t capacity, size_t event_capacity)
+    : arena(requiredMemory(capacity, event_capacity)), row_capacity(capacity), event_capacity(event_capacity)
+{
+    this->event_list = this->arena.allocate_array<ShotStageEvent>(event_capacity);
+    this->time_column = this->arena.allocate_array<uint32_t>(capacity);
+    for (size_t i = 0; i < SHOT_COLUMNS; i++)
+        this->value_columns[i] = this->arena.allocate_array<float>(capacity);
+    this->stage_column = this->arena.allocate_array<uint8_t>(capacity);
+}
+
+void ShotRecorder::record(uint32_t time_ms, uint8_t stage, double setpoint, const SensorState &sensors)
+{
+    if (this->len == this->row_capacity)
+    {
+        this->dropped_rows++;
+        return;
+    }
+
+    size_t row = this->len++;
+    this->time_column[row] = time_ms;
+    this->stage_column[row] = stage;
+    this->value_columns[static_cast<size_t>(ShotColumn::SETPOINT)][row] = setpoint;
+    this->value_columns[static_cast<size_t>(ShotColumn::PRESSURE)][row] = sensors.water_pressure;
+    this->value_columns[static_cast<size_t>(ShotColumn::FLOW)][row] = sensors.water_flow;
+    this->value_columns[static_cast<size_t>(ShotColumn::WEIGHT)][row] = sensors.weight;
+    this->value_columns[static_cast<size_t>(ShotColumn::PISTON_POSITION)][row] = sensors.piston_position;
+    this->value_columns[static_cast<size_t>(ShotColumn::TEMPERATURE)][row] = sensors.stable_temperature;
+    this->value_columns[static_cast<size_t>(ShotColumn::WATER_TEMPERATURE)][row] = sensors.water_temp;
+    this->value_columns[static_cast<size_t>(ShotColumn::PISTON_SPEED)][row] = sensors.piston_speed;
+}
+
+void ShotRecorder::record_transition(uint32_t time_ms, uint8_t stage, uint8_t next_stage, int8_t trigger, ExitType type)
+{
+    if (this->event_len == this->event_capacity)
+    {
+        this->dropped_event_count++;
+        return;
+    }
+    this->event_list[this->event_len++] = {time_ms, stage, next_stage, trigger, type};
+}
+
+void ShotRecorder::clear()
+{
+    this->len = 0;
+    this->event_len = 0;
+    this->dropped_rows = 0;
+    this->dropped_event_count = 0;
+}
+
+void ShotRecorder::write_csv(FILE *sink) const
+{
+    fprintf(sink, "time_ms,stage");
+    for (size_t i = 0; i < SHOT_COLUMNS; i++)
+        fprintf(sink, ",%s", shotColumnName(static_cast<ShotColumn>(i)));
+    fprintf(sink, "\n");
+
+    for (size_t row = 0; row < this->len; row++)
+    {
+        fprintf(sink, "%u,%u", this->time_column[row], this->stage_column[row]);
+        for (size_t i = 0; i < SHOT_COLUMNS; i++)
+            fprintf(sink, ",%.3f", this->value_columns[i][row]);
+        fprintf(sink, "\n");
+    }
+}
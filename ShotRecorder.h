@@ -0,0 +1,100 @@
+#ifndef __SHOT_RECORDER_H__
+#define __SHOT_RECORDER_H__
+
+#include "ProfileArena.h"
+#include "ProfileDefinition.h"
+#include "Sensor.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Stage transitions kept per shot
+#define SHOT_RECORDER_EVENT_CAPACITY 64
+// Exit trigger index of transitions that were not caused by a trigger
+#define SHOT_NO_TRIGGER -1
+
+// Per tick values besides time and stage, all stored as float. TEMPERATURE
+// is the stable temperature temperature exit triggers compare against,
+// WATER_TEMPERATURE the raw water reading it is filtered from.
+enum class ShotColumn : uint8_t
+{
+    SETPOINT,
+    PRESSURE,
+    FLOW,
+    WEIGHT,
+    PISTON_POSITION,
+    TEMPERATURE,
+    WATER_TEMPERATURE,
+    PISTON_SPEED,
+
+    COUNT,
+};
+
+#define SHOT_COLUMNS static_cast<size_t>(ShotColumn::COUNT)
+
+const char *shotColumnName(ShotColumn column);
+
+// A stage exit, trigger is the index into the exit triggers of stage
+struct ShotStageEvent
+{
+    uint32_t time_ms;
+    uint8_t stage;
+    uint8_t next_stage;
+    int8_t trigger;
+    ExitType type;
+};
+
+// Full resolution trace of one shot.
+//
+// Every brewing tick appends one row. The rows are stored column wise, one
+// array per value, so reading a single signal over the whole shot touches
+// only that signal. All columns are carved out of one block when the
+// recorder is created, recording never allocates. Once full, further rows
+// and stage exits are counted as dropped.
+class ShotRecorder
+{
+public:
+    explicit ShotRecorder(size_t capacity, size_t event_capacity = SHOT_RECORDER_EVENT_CAPACITY);
+
+    ShotRecorder(const ShotRecorder &) = delete;
+    ShotRecorder &operator=(const ShotRecorder &) = delete;
+
+    // setpoint is NaN on ticks that exited the stage before sampling
+    void record(uint32_t time_ms, uint8_t stage, double setpoint, const SensorState &sensors);
+    void record_transition(uint32_t time_ms, uint8_t stage, uint8_t next_stage, int8_t trigger, ExitType type);
+
+    // Drops all rows and events, keeps the memory
+    void clear();
+
+    size_t size() const { return this->len; }
+    size_t capacity() const { return this->row_capacity; }
+    size_t dropped() const { return this->dropped_rows; }
+    size_t dropped_events() const { return this->dropped_event_count; }
+
+    const uint32_t *time_ms() const { return this->time_column; }
+    const uint8_t *stage() const { return this->stage_column; }
+    const float *column(ShotColumn column) const { return this->value_columns[static_cast<size_t>(column)]; }
+
+    const ShotStageEvent *events() const { return this->event_list; }
+    size_t events_len() const { return this->event_len; }
+
+    // One line per row with a header, for looking at traces by hand
+    void write_csv(FILE *sink) const;
+
+private:
+    ProfileArena arena;
+    size_t row_capacity;
+    size_t event_capacity;
+    size_t len = 0;
+    size_t event_len = 0;
+    size_t dropped_rows = 0;
+    size_t dropped_event_count = 0;
+
+    ShotStageEvent *event_list;
+    uint32_t *time_column;
+    float *value_columns[SHOT_COLUMNS];
+    uint8_t *stage_column;
+};
+
+#endif
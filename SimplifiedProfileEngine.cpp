@@ -2,6 +2,8 @@
 
 #include "ExitTrigger.h"
 
+#include <cmath>
+
 bool heating_finished()
 {
     return true;
@@ -11,73 +13,51 @@ bool has_reached_final_weight() {
     return false;
 }
 
-void setTargetWeight(double setPoint)
-{
-    printf("Setting target weight to %f\n", setPoint);
-}
-
-void setTargetTemperature(double setPoint)
-{
-    printf("Setting target temperature to %f\n", setPoint);
-}
-
-void setTargetPressure(double setPoint)
-{
-    printf("Setting target pressure to %f\n", setPoint);
-}
-
-void setLimitedPressure(double setPoint)
-{
-    printf("Setting target pressure limit to %f\n", setPoint);
-}
-
-void setTargetFlow(double setPoint)
-{
-    printf("Setting target flow to %f\n", setPoint);
-}
-
-void setLimitedFlow(double setPoint)
-{
-    printf("Setting flow limit to %f\n", setPoint);
-}
-
-void setTargetPower(double setPoint)
-{
-    printf("Setting target power to %f\n", setPoint);
-}
-
-void setTargetPistonPosition(double setPoint)
-{
-    printf("Setting target piston position to %f\n", setPoint);
-}
-
 enum
 {
     STAGE_ENTRY,
     STAGE_EXIT,
 };
 
-void SimplifiedProfileEngine::saveStageLog(bool is_stage_exit, long timestamp)
+void ProfileEngineCore::saveStageLog(bool is_stage_exit, long timestamp)
 {
-    printf("Saving %s log for stage %ld. Timestamp = %ld\n", is_stage_exit == STAGE_ENTRY ? "START" : "EXIT", this->currentStageId, timestamp);
+    logEvent(this->log, LogEvent::STAGE_LOG_SAVED, this->currentStageId, is_stage_exit, timestamp);
     StageLog *log = &this->profile->stage_log[this->currentStageId];
     StageVariables *vars = is_stage_exit == STAGE_ENTRY ? &log->start : &log->end;
 
-    vars->flow = writeProfileFlow(this->driver->get_sensor_data().water_flow);
-    vars->piston_position = writeProfilePercent(this->driver->get_sensor_data().piston_position);
-    vars->pressure = writeProfilePressure(this->driver->get_sensor_data().water_pressure);
+    vars->flow = writeProfileFlow(this->sensors.water_flow);
+    vars->piston_position = writeProfilePercent(this->sensors.piston_position);
+    vars->pressure = writeProfilePressure(this->sensors.water_pressure);
     vars->timestamp = timestamp;
 
     log->valid = true;
 }
 
-void SimplifiedProfileEngine::step()
+void ProfileEngineCore::recordTick(long timestamp, double setpoint)
+{
+    if (this->recorder != nullptr)
+        this->recorder->record(timestamp, this->currentStageId, setpoint, this->sensors);
+}
+
+void ProfileEngineCore::checkStages()
 {
     if (this->profile->stages_len == 0)
     {
         this->state = ProfileState::ERROR;
         throw new NoStagesInProfileException();
     }
+}
+
+bool ProfileEngineCore::needsButton() const
+{
+    return this->state == ProfileState::BREWING &&
+           this->currentStageId < this->profile->stages_len &&
+           this->compiledProfile.exitProgram(this->currentStageId).reads_button();
+}
+
+void ProfileEngineCore::advance(bool button_pressed)
+{
+    this->buttonPressed = button_pressed;
 
     switch (this->state)
     {
@@ -88,9 +68,8 @@ void SimplifiedProfileEngine::step()
         break;
 
     case ProfileState::HEATING:
-        setTargetTemperature(
-            parseProfileTemperature(this->profile->temperature));
-        setTargetWeight(parseProfileWeight(this->profile->finalWeight));
+        this->output.set(ActuatorChannel::TARGET_TEMPERATURE, parseProfileTemperature(this->profile->temperature));
+        this->output.set(ActuatorChannel::TARGET_WEIGHT, parseProfileWeight(this->profile->finalWeight));
         if (heating_finished())
         {
             this->state = ProfileState::READY;
@@ -107,11 +86,11 @@ void SimplifiedProfileEngine::step()
         }
         break;
     case ProfileState::RETRACTING:
-        setTargetPistonPosition(0);
-        if (this->driver->get_sensor_data().piston_position <= 1)
+        this->output.set(ActuatorChannel::TARGET_PISTON_POSITION, 0);
+        if (this->sensors.piston_position <= 1)
         {
             this->state = ProfileState::BREWING;
-            this->profileStartTimestamp = std::chrono::high_resolution_clock::now();
+            this->profileStartTimestamp = this->clock->now();
             saveStageLog(STAGE_ENTRY, 0);
         }
         break;
@@ -128,8 +107,8 @@ void SimplifiedProfileEngine::step()
         }
         break;
     case ProfileState::PURGING:
-        setTargetPistonPosition(100);
-        if (driver->get_sensor_data().piston_position >= 99)
+        this->output.set(ActuatorChannel::TARGET_PISTON_POSITION, 100);
+        if (this->sensors.piston_position >= 99)
         {
             this->state = ProfileState::END;
         }
@@ -143,23 +122,30 @@ void SimplifiedProfileEngine::step()
     }
 }
 
-ProfileState SimplifiedProfileEngine::transitionStage(size_t target_stage)
+ProfileState ProfileEngineCore::transitionStage(size_t target_stage, const ExitTrigger *trigger)
 {
-    auto end_time = std::chrono::high_resolution_clock::now();
+    auto end_time = this->clock->now();
     auto time_passed_ms = (end_time - this->profileStartTimestamp) / std::chrono::milliseconds(1);
 
     saveStageLog(STAGE_EXIT, time_passed_ms);
+    if (this->recorder != nullptr)
+    {
+        const Stage *stage = &this->profile->stages[this->currentStageId];
+        int8_t index = trigger != nullptr ? trigger - stage->exitTrigger : SHOT_NO_TRIGGER;
+        ExitType type = trigger != nullptr ? trigger->type : ExitType::EXIT_TIME;
+        this->recorder->record_transition(time_passed_ms, this->currentStageId, target_stage, index, type);
+    }
 
     if (target_stage == this->currentStageId)
     {
-        printf("Profile End reached via stage end\n");
+        logEvent(this->log, LogEvent::PROFILE_END_STAGE);
         return ProfileState::DONE;
     }
 
     this->currentStageId = target_stage;
     if (this->currentStageId >= this->profile->stages_len)
     {
-        printf("Next StageID unreachable");
+        logEvent(this->log, LogEvent::NEXT_STAGE_UNREACHABLE);
         return ProfileState::DONE;
     }
     saveStageLog(STAGE_ENTRY, time_passed_ms);
@@ -167,23 +153,23 @@ ProfileState SimplifiedProfileEngine::transitionStage(size_t target_stage)
     return ProfileState::BREWING;
 }
 
-ProfileState SimplifiedProfileEngine::processStageStep()
+ProfileState ProfileEngineCore::processStageStep()
 {
     if (this->currentStageId >= this->profile->stages_len)
     {
-        printf("StageID unreachable");
+        logEvent(this->log, LogEvent::STAGE_UNREACHABLE);
         return ProfileState::ERROR;
     }
 
     if (has_reached_final_weight())
     {
-        printf("Profile End reached via final weight hit\n");
+        logEvent(this->log, LogEvent::PROFILE_END_WEIGHT);
         return ProfileState::DONE;
     }
 
-    printf("executing stage=%d\n", (short)this->currentStageId);
+    logEvent(this->log, LogEvent::STAGE_STEP, this->currentStageId);
 
-    auto now = std::chrono::high_resolution_clock::now();
+    auto now = this->clock->now();
     auto profile_time_passed = (now - this->profileStartTimestamp) / std::chrono::milliseconds(1);
 
     const Stage *stage = &this->profile->stages[this->currentStageId];
@@ -193,23 +179,39 @@ ProfileState SimplifiedProfileEngine::processStageStep()
         saveStageLog(STAGE_ENTRY, profile_time_passed);
     }
 
-    // Ensure the sampler is fed with the right stage
+    const ExitProgram &exit_program = this->compiledProfile.exitProgram(this->currentStageId);
+
+    // Ensure the sampler and the exit deadline are set up for the right stage
     if (this->sampler.stageId != this->currentStageId)
     {
-        this->sampler.load_new_stage(stage, this->currentStageId);
+        this->sampler.use_stage(this->compiledProfile.samplerStage(this->currentStageId), this->currentStageId);
+        this->exitDeadline = exit_program.deadline(log->start.timestamp);
     }
 
     auto stage_timestamp = (now - (this->profileStartTimestamp + (log->start.timestamp * std::chrono::milliseconds(1)))) / std::chrono::milliseconds(1);
 
-    for (size_t i = 0; i < stage->exitTrigger_len; i++)
+    // Once a time deadline passed, the time trigger only wins if no trigger
+    // listed before it fires on this tick, like in plain profile order
+    ExitDeadline passed = {EXIT_NO_DEADLINE, 0, nullptr};
+    if (profile_time_passed >= this->exitDeadline.deadline)
+        passed = exit_program.passed_deadline(log->start.timestamp, profile_time_passed);
+
+    const CompiledExitTrigger *trigger = exit_program.evaluate(this->sensors, this->buttonPressed, stage_timestamp, profile_time_passed, this->log, passed.trigger);
+    if (trigger != nullptr)
     {
-        const ExitTrigger *trigger = &stage->exitTrigger[i];
-        bool should_exit = checkExitCondition(trigger, this->driver, stage_timestamp, profile_time_passed);
-        if (should_exit)
-        {
-            printf("Exit trigger activated!\n");
-            return this->transitionStage(trigger->target_stage);
-        }
+        logEvent(this->log, LogEvent::EXIT_TRIGGER_ACTIVATED);
+        this->recordTick(profile_time_passed, NAN);
+        return this->transitionStage(trigger->target_stage, trigger->trigger);
+    }
+
+    if (passed.trigger != nullptr)
+    {
+        // Logged like the other triggers, the time the trigger compares against its value
+        long trigger_time = passed.trigger->reference == ExitReferenceType::EXIT_REF_ABSOLUTE ? profile_time_passed : stage_timestamp;
+        logEvent(this->log, LogEvent::EXIT_TRIGGER_GREATER, static_cast<int>(ExitType::EXIT_TIME), trigger_time / 1000.0, parseExitValue(passed.trigger->value));
+        logEvent(this->log, LogEvent::EXIT_TRIGGER_ACTIVATED);
+        this->recordTick(profile_time_passed, NAN);
+        return this->transitionStage(passed.target_stage, passed.trigger);
     }
 
     long input_reference_value = 0;
@@ -219,56 +221,62 @@ ProfileState SimplifiedProfileEngine::processStageStep()
         input_reference_value = stage_timestamp;
         break;
     case InputType::INPUT_PISTON_POSITION:
-        input_reference_value = this->driver->get_sensor_data().piston_position;
+        input_reference_value = this->sensors.piston_position;
         break;
     case InputType::INPUT_WEIGHT:
-        input_reference_value = this->driver->get_sensor_data().weight;
+        input_reference_value = this->sensors.weight;
         break;
     default:
-        printf("Invalid input reference type! Aborting");
+        logEvent(this->log, LogEvent::INVALID_INPUT_TYPE);
         return ProfileState::ERROR;
     }
 
     double sampled_output = sampler.get(input_reference_value);
-    printf("sampled (%ld,%f)\n", input_reference_value, sampled_output);
-    printf("Setting output at %ld ms to %f\n", profile_time_passed, sampled_output);
+    logEvent(this->log, LogEvent::SAMPLED, profile_time_passed, input_reference_value, sampled_output);
+    this->recordTick(profile_time_passed, sampled_output);
 
     // Dont use the parsed value for limiter checks here as the
-    // float might not be perfectly encoding zero
+    // float might not be perfectly encoding zero. A zero limit lifts the
+    // limit of a previous stage.
+    double flow_limit = 0;
     if (stage->dynamics.limits.flow > 0)
-    {
-        auto flow_limit = parseProfileFlow(stage->dynamics.limits.flow);
-        setLimitedFlow(flow_limit);
-    }
+        flow_limit = parseProfileFlow(stage->dynamics.limits.flow);
+    this->output.set(ActuatorChannel::FLOW_LIMIT, flow_limit);
+    double pressure_limit = 0;
     if (stage->dynamics.limits.pressure > 0)
-    {
-        auto pressure_limit = parseProfilePressure(stage->dynamics.limits.pressure);
-        setLimitedFlow(pressure_limit);
-    }
+        pressure_limit = parseProfilePressure(stage->dynamics.limits.pressure);
+    this->output.set(ActuatorChannel::PRESSURE_LIMIT, pressure_limit);
 
     switch (stage->dynamics.controlSelect)
     {
     case ControlType::CONTROL_PRESSURE:
-        setTargetPressure(sampled_output);
+        this->output.set(ActuatorChannel::TARGET_PRESSURE, sampled_output);
         break;
     case ControlType::CONTROL_FLOW:
-        setTargetFlow(sampled_output);
+        this->output.set(ActuatorChannel::TARGET_FLOW, sampled_output);
         break;
     case ControlType::CONTROL_POWER:
-        setTargetPower(sampled_output);
+        this->output.set(ActuatorChannel::TARGET_POWER, sampled_output);
         break;
     case ControlType::CONTROL_PISTON_POSITION:
-        setTargetPistonPosition(sampled_output);
+        this->output.set(ActuatorChannel::TARGET_PISTON_POSITION, sampled_output);
         break;
     default:
-        printf("Invalid control method! Aborting");
+        logEvent(this->log, LogEvent::INVALID_CONTROL_TYPE);
         return ProfileState::ERROR;
     }
 
     return ProfileState::BREWING;
 }
 
-SimplifiedProfileEngine :: ~SimplifiedProfileEngine() {
+std::optional<ProfileClock::time_point> ProfileEngineCore::nextExitDeadline() const
+{
+    if (this->state != ProfileState::BREWING || this->exitDeadline.deadline == EXIT_NO_DEADLINE)
+        return std::nullopt;
+    return this->profileStartTimestamp + std::chrono::milliseconds(this->exitDeadline.deadline);
+}
+
+ProfileEngineCore::~ProfileEngineCore() {
     Profile *prof = this->profile;
     freeProfile(prof);
 }
\ No newline at end of file
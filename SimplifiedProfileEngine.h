@@ -2,10 +2,15 @@
 #define __SIMPLIFIED_PROFILE_ENGINE_H__
 
 #include "Sensor.h"
-#include "Sampler.h"
+#include "ActuatorOutput.h"
+#include "CompiledProfile.h"
+#include "EventLog.h"
+#include "ProfileClock.h"
 #include "ProfileDefinition.h"
+#include "ShotRecorder.h"
 #include <exception>
 #include <chrono>
+#include <optional>
 
 enum class ProfileState
 {
@@ -25,29 +30,101 @@ enum class ProfileState
 
 struct NoStagesInProfileException : std::exception {};
 
-class SimplifiedProfileEngine
+// Everything of the engine that does not touch the driver. It works on the
+// sensor snapshot of the current step and collects the actuator commands,
+// SimplifiedProfileEngine moves both between the driver and the core.
+class ProfileEngineCore
 {
     Profile *profile;
-    Driver *driver;
+    CompiledProfile compiledProfile;
+    ProfileClock realtimeClock;
+    ProfileClock *clock;
     ProfileState processStageStep();
 
     size_t currentStageId = 0;
-    Sampler sampler;
+    EngineSampler sampler;
     void saveStageLog(bool is_stage_entry, long timestamp);
-    ProfileState transitionStage(size_t target_stage);
-    std::chrono::high_resolution_clock::time_point profileStartTimestamp;
+    // trigger is the exit trigger that fired
+    ProfileState transitionStage(size_t target_stage, const ExitTrigger *trigger);
+    void recordTick(long timestamp, double setpoint);
+    ProfileClock::time_point profileStartTimestamp;
+    // Time trigger deadline of the current stage
+    ExitDeadline exitDeadline = {EXIT_NO_DEADLINE, 0, nullptr};
+    bool buttonPressed = false;
+    ShotRecorder *recorder = nullptr;
 
-public:
-    SimplifiedProfileEngine(Profile *ext_profile, Driver *ext_driver) :  profile(ext_profile), driver(ext_driver), state(ProfileState::IDLE) {}
-    ~SimplifiedProfileEngine();
+protected:
+    EventLog *log;
+    ActuatorOutput output;
+    // Sensor snapshot taken at the start of the current step
+    SensorState sensors;
+
+    ProfileEngineCore(Profile *ext_profile, EventLog *ext_log, ProfileClock *ext_clock)
+        : profile(ext_profile), compiledProfile(ext_profile), realtimeClock(),
+          clock(ext_clock ? ext_clock : &realtimeClock), log(ext_log), output(), sensors(), state(ProfileState::IDLE) {}
+    ~ProfileEngineCore();
+
+    // Throws NoStagesInProfileException for an empty profile
+    void checkStages();
+    // Whether this step has to read the button from the driver
+    bool needsButton() const;
+    // Runs one step on this->sensors
+    void advance(bool button_pressed);
 
+public:
     void start() {
         this->currentStageId = 0;
+        // The machine may have been commanded by someone else since
+        this->output.reset();
+        if (this->recorder != nullptr)
+            this->recorder->clear();
         this->state = ProfileState::HEATING;
     }
-    void step();
+
+    // Records every brewing tick and stage exit into recorder from now on,
+    // nullptr stops recording. start() clears the recorder.
+    void attachRecorder(ShotRecorder *ext_recorder) {
+        this->recorder = ext_recorder;
+    }
+
+    // When the current stage will exit through a time trigger, so a scheduler
+    // can step exactly then
+    std::optional<ProfileClock::time_point> nextExitDeadline() const;
+
+    const ActuatorOutputStats &actuatorStats() const {
+        return this->output.stats();
+    }
 
     ProfileState state;
 };
 
-#endif
\ No newline at end of file
+// Engine running a profile on a machine. The driver type is a template
+// parameter so sensor reads and actuator writes inline into the step.
+template <ProfileDriver DriverT = Driver>
+class SimplifiedProfileEngine : public ProfileEngineCore
+{
+    DriverT *driver;
+
+public:
+    // The engine only logs into ext_log if one is given. An EventLog has a
+    // single producer, so engines running at the same time each need their
+    // own. Pass a simulated clock to run detached from wall clock time, the
+    // engine reads steady_clock otherwise.
+    SimplifiedProfileEngine(Profile *ext_profile, DriverT *ext_driver, EventLog *ext_log = nullptr, ProfileClock *ext_clock = nullptr)
+        : ProfileEngineCore(ext_profile, ext_log, ext_clock), driver(ext_driver) {}
+
+    void step()
+    {
+        this->checkStages();
+
+        // Every decision of this tick is based on the same sensor values
+        this->sensors = this->driver->get_sensor_data();
+        bool button_pressed = this->needsButton() && this->driver->get_button_gesture("Encoder Button", "Single Tap");
+        this->advance(button_pressed);
+
+        // One transaction with everything that changed during this step
+        this->output.flush(this->driver, this->log);
+    }
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include "StepScheduler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+static constexpr int64_t NS_PER_SECOND = 1000000000;
+
+static int64_t toNanoseconds(const struct timespec &time)
+{
+    return time.tv_sec * NS_PER_SECOND + time.tv_nsec;
+}
+
+static struct timespec fromNanoseconds(int64_t time)
+{
+    struct timespec result;
+    result.tv_sec = time / NS_PER_SECOND;
+    result.tv_nsec = time % NS_PER_SECOND;
+    return result;
+}
+
+StepScheduler::StepScheduler(std::chrono::nanoseconds period, std::chrono::nanoseconds histogram_bin_width)
+    : period_ns(period.count()), histogram_bin_width_ns(std::max<int64_t>(histogram_bin_width.count(), 1))
+{
+}
+
+void StepScheduler::start()
+{
+    this->statistics = StepSchedulerStats();
+    this->early_wakeup_ns = 0;
+    this->woke_early = false;
+    clock_gettime(CLOCK_MONOTONIC, &this->deadline);
+}
+
+void StepScheduler::wake_at(std::chrono::steady_clock::time_point time)
+{
+    // libstdc++ implements steady_clock on top of CLOCK_MONOTONIC
+    int64_t time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    if (this->early_wakeup_ns == 0 || time_ns < this->early_wakeup_ns)
+        this->early_wakeup_ns = std::max<int64_t>(time_ns, 1);
+}
+
+void StepScheduler::wait_for_next_tick()
+{
+    this->woke_early = this->early_wakeup_ns != 0 && this->early_wakeup_ns < toNanoseconds(this->deadline);
+    struct timespec target = this->woke_early ? fromNanoseconds(this->early_wakeup_ns) : this->deadline;
+    this->early_wakeup_ns = 0;
+
+    int error;
+    // Interrupted by a signal, sleep again towards the same deadline
+    while ((error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, nullptr)) == EINTR)
+    {
+    }
+    if (error != 0)
+        throw new StepSchedulerError(std::string("cannot sleep until the next tick: ") + strerror(error));
+    clock_gettime(CLOCK_MONOTONIC, &this->wakeup);
+
+    int64_t latency = std::max<int64_t>(toNanoseconds(this->wakeup) - toNanoseconds(target), 0);
+    size_t bin = std::min<int64_t>(latency / this->histogram_bin_width_ns, STEP_SCHEDULER_HISTOGRAM_BINS - 1);
+    this->statistics.latency_histogram[bin]++;
+    this->statistics.total_latency_ns += latency;
+    this->statistics.max_latency_ns = std::max(this->statistics.max_latency_ns, latency);
+}
+
+void StepScheduler::finish_tick()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t finished = toNanoseconds(now);
+    // An early tick leaves the periodic deadline where it was
+    int64_t next_deadline = toNanoseconds(this->deadline) + (this->woke_early ? 0 : this->period_ns);
+    this->statistics.ticks++;
+    this->statistics.max_tick_duration_ns = std::max(this->statistics.max_tick_duration_ns, finished - toNanoseconds(this->wakeup));
+
+    if (finished > next_deadline)
+    {
+        // Skip the periods we are already late for instead of bursting through them
+        int64_t missed = (finished - next_deadline) / this->period_ns + 1;
+        this->statistics.overruns++;
+        this->statistics.missed_ticks += missed;
+        next_deadline += missed * this->period_ns;
+    }
+    this->deadline = fromNanoseconds(next_deadline);
+}
+
+void StepScheduler::print_stats(FILE *sink) const
+{
+    const StepSchedulerStats &stats = this->statistics;
+    fprintf(sink, "Scheduler: %lu ticks at %ld us, %lu overruns, %lu missed ticks\n",
+            stats.ticks, this->period_ns / 1000, stats.overruns, stats.missed_ticks);
+    if (stats.ticks == 0)
+        return;
+    fprintf(sink, "Scheduler: wakeup latency mean %ld us, max %ld us, longest tick %ld us\n",
+            stats.total_latency_ns / static_cast<int64_t>(stats.ticks) / 1000,
+            stats.max_latency_ns / 1000,
+            stats.max_tick_duration_ns / 1000);
+    for (size_t bin = 0; bin < STEP_SCHEDULER_HISTOGRAM_BINS; bin++)
+    {
+        if (stats.latency_histogram[bin] == 0)
+            continue;
+        bool is_last = bin == STEP_SCHEDULER_HISTOGRAM_BINS - 1;
+        fprintf(sink, "Scheduler: latency %s%ld us: %lu\n",
+                is_last ? ">= " : "< ",
+                (is_last ? bin : bin + 1) * this->histogram_bin_width_ns / 1000,
+                stats.latency_histogram[bin]);
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef __STEP_SCHEDULER_H__
+#define __STEP_SCHEDULER_H__
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <time.h>
+
+// Number of wakeup latency histogram bins, the last one collects everything
+// beyond the histogram range
+#define STEP_SCHEDULER_HISTOGRAM_BINS 32
+
+struct StepSchedulerStats
+{
+    uint64_t ticks = 0;
+    // Ticks that were still running when the next one was due
+    uint64_t overruns = 0;
+    // Periods skipped to resynchronize after an overrun
+    uint64_t missed_ticks = 0;
+    int64_t max_latency_ns = 0;
+    int64_t total_latency_ns = 0;
+    int64_t max_tick_duration_ns = 0;
+    std::array<uint64_t, STEP_SCHEDULER_HISTOGRAM_BINS> latency_histogram = {};
+};
+
+struct StepSchedulerError : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Calls a tick function at a fixed absolute period on CLOCK_MONOTONIC.
+//
+// Deadlines are advanced by exactly one period per tick and slept on with
+// clock_nanosleep(TIMER_ABSTIME), so the execution time of a tick does not
+// accumulate as drift. The wakeup latency against each deadline, the tick
+// durations and overruns are recorded. Single ticks can be pulled in with
+// wake_at(), e.g. to hit an exit deadline between two periods.
+class StepScheduler
+{
+public:
+    explicit StepScheduler(
+        std::chrono::nanoseconds period,
+        std::chrono::nanoseconds histogram_bin_width = std::chrono::microseconds(10));
+
+    // Runs until tick() returns false. Throws StepSchedulerError if it
+    // cannot sleep until a deadline.
+    template <typename Tick>
+    void run(Tick tick)
+    {
+        this->start();
+        while (true)
+        {
+            this->wait_for_next_tick();
+            bool keep_running = tick();
+            this->finish_tick();
+            if (!keep_running)
+                break;
+        }
+    }
+
+    // Runs the next tick at time instead of the next period if that is
+    // earlier. The periodic grid itself is not shifted.
+    void wake_at(std::chrono::steady_clock::time_point time);
+
+    const StepSchedulerStats &stats() const { return this->statistics; }
+    void print_stats(FILE *sink) const;
+
+private:
+    int64_t period_ns;
+    int64_t histogram_bin_width_ns;
+    struct timespec deadline;
+    struct timespec wakeup;
+    // Requested early wakeup in ns on CLOCK_MONOTONIC, 0 if there is none
+    int64_t early_wakeup_ns = 0;
+    bool woke_early = false;
+    StepSchedulerStats statistics;
+
+    void start();
+    void wait_for_next_tick();
+    void finish_tick();
+};
+
+#endif
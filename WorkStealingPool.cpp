@@ -0,0 +1,56 @@
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <thread>
+
+WorkStealingPool::WorkStealingPool(size_t threads)
+    : thread_count(threads > 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u)),
+      queues(thread_count)
+{
+}
+
+bool WorkStealingPool::next_job(size_t worker, size_t &job)
+{
+    {
+        WorkQueue &own = this->queues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.jobs.empty())
+        {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t offset = 1; offset < this->thread_count; offset++)
+    {
+        WorkQueue &victim = this->queues[(worker + offset) % this->thread_count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(size_t jobs, const std::function<void(size_t, size_t)> &job)
+{
+    for (size_t index = 0; index < jobs; index++)
+        this->queues[index % this->thread_count].jobs.push_back(index);
+
+    std::vector<std::thread> workers;
+    workers.reserve(this->thread_count);
+    for (size_t worker = 0; worker < this->thread_count; worker++)
+    {
+        workers.emplace_back([this, worker, &job]()
+                             {
+            size_t index;
+            while (this->next_job(worker, index))
+                job(index, worker); });
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+}
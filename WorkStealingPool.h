@@ -0,0 +1,40 @@
+#ifndef __WORK_STEALING_POOL_H__
+#define __WORK_STEALING_POOL_H__
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Runs a batch of independent jobs on a fixed number of threads.
+//
+// Job indices are dealt round robin into one deque per worker. A worker takes
+// jobs from the back of its own deque and, once that is empty, steals from the
+// front of the others, so long running jobs do not leave cores idle. Every
+// deque has its own lock, workers only contend while stealing.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(size_t threads = 0);
+
+    // Calls job(index, worker) for every index in [0, jobs) and returns once
+    // all of them are done. worker is in [0, threads()).
+    void run(size_t jobs, const std::function<void(size_t, size_t)> &job);
+
+    size_t threads() const { return this->thread_count; }
+
+private:
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    size_t thread_count;
+    std::vector<WorkQueue> queues;
+
+    bool next_job(size_t worker, size_t &job);
+};
+
+#endif
@@ -1,10 +1,18 @@
 #include "ProfileDefinition.h"
 #include "SimplifiedProfileEngine.h"
 #include "ProfileGenerator.h"
+#include "StepScheduler.h"
+#include "FleetSimulator.h"
+#include "ProfileBinary.h"
+#include "PuckSimulator.h"
+#include "ShotAnalytics.h"
+#include "ShotArchive.h"
+#include "ShotRecorder.h"
 
 #include <chrono>
 #include <thread>
 #include <algorithm>
+#include <cstring>
 
 const char* profileJson = R"JSON({
     "name": "E61 with dropping pressure",
@@ -78,8 +86,87 @@ const char* profileJson = R"JSON({
 })JSON";
 
 
-int main(void)
+// Runs the example profile against a grind / dose matrix on all cores. With
+// an archive path the shots are archived there and analyzed from the archive.
+static int runFleet(const char *archive_path)
 {
+    FleetSimulator simulator;
+    simulator.add_profile(profileJson);
+    if (archive_path != nullptr)
+        simulator.set_archive(archive_path);
+
+    const double grinds[] = {0.8, 1.0, 1.2, 1.5};
+    const double doses[] = {16.0, 18.0, 20.0};
+    const uint32_t seeds_per_scenario = 100;
+    for (double grind : grinds)
+        for (double dose : doses)
+            for (uint32_t seed = 0; seed < seeds_per_scenario; seed++)
+                simulator.add_scenario({"grind/dose", grind, dose, seed});
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SimulationResult> results = simulator.run();
+    auto elapsed_ms = (std::chrono::steady_clock::now() - start) / std::chrono::milliseconds(1);
+
+    simulator.print_summary(results, stdout);
+    printf("Simulated %zu shots in %ld ms\n", results.size(), static_cast<long>(elapsed_ms));
+    if (archive_path == nullptr)
+        return 0;
+
+    start = std::chrono::steady_clock::now();
+    MappedShotArchive archive(archive_path);
+    ShotAnalytics analytics;
+    analytics.add_archive(&archive, 0);
+    std::vector<ProfileAggregate> aggregates = analytics.run();
+    elapsed_ms = (std::chrono::steady_clock::now() - start) / std::chrono::milliseconds(1);
+
+    analytics.print(aggregates, stdout);
+    printf("Analyzed %zu archived shots in %ld ms\n", archive.size(), static_cast<long>(elapsed_ms));
+    return 0;
+}
+
+// Compiles the example profile to a binary file, maps it back and runs one
+// simulated shot straight from the mapping
+static int runBinary(const char *path)
+{
+    ProfileGenerator generator(profileJson);
+    writeProfileBinary(&generator.profile, path);
+    // The engine runs on the mapping, nothing else uses the parsed profile
+    freeProfile(&generator.profile);
+    MappedProfile mapped(path);
+    printf("Mapped %d stages from %s\n", mapped.profile.stages_len, path);
+
+    PuckSimulator driver;
+    ProfileClock clock = ProfileClock::simulation();
+    SimplifiedProfileEngine engine(&mapped.profile, &driver, nullptr, &clock);
+    const std::chrono::milliseconds tick(10);
+    const uint32_t max_ticks = std::chrono::seconds(120) / tick;
+    uint32_t ticks = 0;
+    engine.start();
+    while (engine.state != ProfileState::DONE && engine.state != ProfileState::ERROR && ticks++ < max_ticks)
+    {
+        engine.step();
+        driver.advance(std::chrono::duration<double>(tick).count());
+        clock.advance(tick);
+    }
+
+    for (int i = 0; i < mapped.profile.stages_len; i++)
+    {
+        const StageLog &log = mapped.profile.stage_log[i];
+        if (log.valid)
+            printf("Stage %d ran from %ld to %ld ms\n", i, (long)log.start.timestamp, (long)log.end.timestamp);
+    }
+    printf("The engine finished in state %d after %u ticks\n", (short)engine.state, ticks);
+    return engine.state == ProfileState::DONE ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    // --fleet [archive]
+    if (argc > 1 && strcmp(argv[1], "--fleet") == 0)
+        return runFleet(argc > 2 ? argv[2] : nullptr);
+    // --binary <file>
+    if (argc > 2 && strcmp(argv[1], "--binary") == 0)
+        return runBinary(argv[2]);
 
     // Profile maxProfile;
     // maxProfile.stages_len = 2;
@@ -128,10 +215,14 @@ int main(void)
     Profile maxProfile = generator.profile;
 
 
-    Driver driver;
-    SimplifiedProfileEngine engine(&maxProfile, &driver);
+    PuckSimulator driver;
+    SimplifiedProfileEngine engine(&maxProfile, &driver, &engineLog);
+    // Two minutes of 50ms ticks
+    ShotRecorder recorder(2400);
+    engine.attachRecorder(&recorder);
     printf("After creating the engine is in state: %d\n", (short)engine.state);
 
+    engineLog.start();
     try
     {
         engine.step();
@@ -139,18 +230,55 @@ int main(void)
         printf("Starting engine\n");
         engine.start();
         printf("The engine is in state: %d\n",(short) engine.state);
-        while (engine.state != ProfileState::DONE) {
+        StepScheduler scheduler(std::chrono::milliseconds(50));
+        auto previous_tick = std::chrono::steady_clock::now();
+        scheduler.run([&]()
+                      {
+            // Ticks pulled in by wake_at come early, so the simulated machine
+            // follows the commands of the last step for the time that really passed
+            auto now = std::chrono::steady_clock::now();
+            driver.advance(std::chrono::duration<double>(now - previous_tick).count());
+            previous_tick = now;
             engine.step();
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
-            // We fake the piston moving 1% each step to show the piston position samping capabilities
-            if (engine.state == ProfileState::BREWING)
-                driver.sensors.piston_position = std::min<double>(driver.sensors.piston_position + 1, 100.0);
-        }
+            if (auto deadline = engine.nextExitDeadline())
+                scheduler.wake_at(*deadline);
+            return engine.state != ProfileState::DONE; });
+        engineLog.stop();
         printf("Profile execution finished.\n");
+        scheduler.print_stats(stdout);
+        const ActuatorOutputStats &actuators = engine.actuatorStats();
+        printf("Actuators: %zu of %zu commands sent in %zu batches\n", actuators.sent, actuators.requested, actuators.batches);
+        printf("Recorded %zu ticks and %zu stage exits\n", recorder.size(), recorder.events_len());
+        // --trace <file> writes the recorded shot as CSV
+        if (argc > 2 && strcmp(argv[1], "--trace") == 0)
+        {
+            FILE *trace = fopen(argv[2], "w");
+            if (trace != nullptr)
+            {
+                recorder.write_csv(trace);
+                fclose(trace);
+            }
+        }
+        // --archive <file> stores it in a compressed shot archive
+        if (argc > 2 && strcmp(argv[1], "--archive") == 0)
+        {
+            ShotArchiveWriter archive(argv[2]);
+            archive.append(recorder, 0);
+            archive.close();
+            size_t raw_size = recorder.size() * (sizeof(uint32_t) + sizeof(uint8_t) + SHOT_COLUMNS * sizeof(double));
+            printf("Archived %zu ticks in %lu bytes (%zu bytes as doubles)\n", recorder.size(), (unsigned long)archive.size(), raw_size);
+        }
         printf("Profile allocated 0x%02lX bytes(%ld kB) of ram for all %d stages combined\n", generator.memoryUsed, generator.memoryUsed / 1024, maxProfile.stages_len);
     }
     catch (const NoStagesInProfileException *&e)
     {
         printf("No Stages in profile!!!");
     }
+    catch (StepSchedulerError *e)
+    {
+        engineLog.stop();
+        printf("%s\n", e->what());
+        delete e;
+        return 1;
+    }
 }
\ No newline at end of file